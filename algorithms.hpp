@@ -11,14 +11,102 @@
 
 #pragma once
 
-#include <string>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
 namespace algorithms {
 
+  // Character classes used by the run-length-encoding alphabets below.
+  //
+  // invalid_char  - may not appear in the input; encoding throws
+  // plain_char    - copied to the output as-is
+  // escaped_char  - written with a leading '\' so it cannot be confused
+  //                 with the digits of a COUNT
+  enum char_class : unsigned char { invalid_char, plain_char, escaped_char };
+
+  // Escape prefix written before every escaped_char.
+  const char RLE_ESCAPE = '\\';
+
+  // Alphabet policies for run_length_encode.
+  //
+  // Each policy provides a constexpr classify() for a single byte; the
+  // 256-entry table built from it by alphabet_table is what the encoder
+  // actually reads, so validation costs one load per character.
+
+  // Lower-case letters and spaces only. This is the default alphabet.
+  struct lowercase_alphabet {
+    static constexpr char_class classify(unsigned char c) {
+      return ((c >= 'a' && c <= 'z') || c == ' ') ? plain_char : invalid_char;
+    }
+  };
+
+  // Printable ASCII, 0x20 through 0x7E. Digits and '\' are escaped.
+  struct printable_alphabet {
+    static constexpr char_class classify(unsigned char c) {
+      if (c < 0x20 || c > 0x7E) {
+        return invalid_char;
+      }
+      return ((c >= '0' && c <= '9') || c == RLE_ESCAPE) ? escaped_char : plain_char;
+    }
+  };
+
+  // Any byte value, so binary or UTF-8 payloads can be encoded without a
+  // pre-pass. Digits and '\' are escaped.
+  struct byte_alphabet {
+    static constexpr char_class classify(unsigned char c) {
+      return ((c >= '0' && c <= '9') || c == RLE_ESCAPE) ? escaped_char : plain_char;
+    }
+  };
+
+  // Compile-time character-class table for an alphabet policy.
+  template <typename Alphabet>
+  struct alphabet_table {
+    static constexpr std::array<char_class, 256> build() {
+      std::array<char_class, 256> table{};
+      for (unsigned c = 0; c < 256; ++c) {
+        table[c] = Alphabet::classify(static_cast<unsigned char>(c));
+      }
+      return table;
+    }
+
+    static constexpr std::array<char_class, 256> value = build();
+
+    // True if any character of the alphabet is written escaped, so the
+    // encoding can be longer than its input.
+    static constexpr bool has_escapes() {
+      for (char_class k : value) {
+        if (k == escaped_char) {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
   // Run-length-encode the given string.
   //
-  // uncompressed must be a string containing only lower-case letters or spaces.
+  // uncompressed must be a string containing only characters accepted by
+  // Alphabet; by default that is lower-case letters or spaces.
   //
   // A run is defined as a sequence of K>2 contiguous copies of the same
   // character c.
@@ -27,59 +115,864 @@ namespace algorithms {
   // replaced with the string
   //   COUNTc
   // where COUNT is the base-10 representation of K. Non-run characters are
-  // left as-is.
+  // left as-is. Characters the alphabet classifies as escaped_char (digits
+  // and '\' in printable_alphabet and byte_alphabet) are written as "\c".
   //
   // Example inputs and outputs:
   //   "aaa" -> "3a"
   //   "heloooooooo there" -> "hel8o there"
   //   "footloose and fancy free" -> "f2otl2ose and fancy fr2e"
+  //   run_length_encode<printable_alphabet>("A11") -> "A2\1"
   //
   // Throws std::invalid_argument if the string contains invalid characters.
+  // Validation happens in the same pass as encoding.
 
-  void append_run(std::string& C, char& run_char, int& run_length) {
+  template <typename Alphabet = lowercase_alphabet>
+  void append_run(std::string& C, char run_char, size_t run_length) {
     if (run_length > 1) {
       C += std::to_string(run_length);
     }
 
-    C += (run_char);
+    if (alphabet_table<Alphabet>::value[static_cast<unsigned char>(run_char)] == escaped_char) {
+      C += RLE_ESCAPE;
+    }
+
+    C += run_char;
   }
 
-  std::string run_length_encode(const std::string& uncompressed) {
-    for (char c : uncompressed) {
-      if ((c < 97 && c != 32) || c > 122) {
-        throw std::invalid_argument("Invalid Input!");
+  // Encoding kernels for run_length_encode. All of them produce identical
+  // output and validate in the same pass as they encode; they differ only
+  // in which data they are fastest on.
+  //
+  // scan          - one comparison per character; the general case
+  // literal_copy  - for data with few runs, e.g. uniform random letters:
+  //                 finds the next pair of equal characters and appends
+  //                 the literal characters before it in one block
+  // run_skip      - for data with long runs, e.g. logs: skips over a run
+  //                 eight bytes per comparison
+  enum class rle_strategy { scan, literal_copy, run_skip };
+
+  // What run_length_encode learned from sampling its input.
+  struct rle_stats {
+    rle_strategy strategy;   // kernel that was used
+    double mean_run_length;  // sampled characters per maximal run
+    double run_density;      // fraction of sampled characters in runs of K>=2
+    size_t sampled;          // characters sampled
+  };
+
+  // Inputs are sampled in up to this many evenly spaced windows...
+  const size_t RLE_SAMPLE_WINDOWS = 8;
+  // ...of this many characters each, using one window per four windows'
+  // worth of input so that the sample is never more than a quarter of it.
+  const size_t RLE_SAMPLE_WINDOW_SIZE = 32;
+  // Inputs shorter than this get no window and use the scan kernel.
+  const size_t RLE_SAMPLE_MIN_SIZE = 4 * RLE_SAMPLE_WINDOW_SIZE;
+
+  // Estimates the run profile of uncompressed from a sample and picks the
+  // kernel for it.
+  rle_stats sample_runs(std::string_view uncompressed) {
+    size_t n = uncompressed.size();
+    size_t windows = std::min(RLE_SAMPLE_WINDOWS, n / RLE_SAMPLE_MIN_SIZE);
+    if (windows == 0) {
+      return rle_stats{ rle_strategy::scan, 0, 0, 0 };
+    }
+
+    size_t sampled = 0, runs = 0, in_runs = 0;
+    for (size_t w = 0; w < windows; w++) {
+      size_t first = (windows == 1) ? 0 : (n - RLE_SAMPLE_WINDOW_SIZE) / (windows - 1) * w;
+      size_t i = first, last = first + RLE_SAMPLE_WINDOW_SIZE;
+      while (i < last) {
+        size_t j = i + 1;
+        while (j < last && uncompressed[j] == uncompressed[i]) {
+          j++;
+        }
+        runs++;
+        if (j - i > 1) {
+          in_runs += j - i;
+        }
+        i = j;
       }
+      sampled += RLE_SAMPLE_WINDOW_SIZE;
     }
 
+    rle_stats stats;
+    stats.sampled = sampled;
+    stats.mean_run_length = runs ? double(sampled) / runs : 0;
+    stats.run_density = sampled ? double(in_runs) / sampled : 0;
+
+    if (stats.mean_run_length >= 8) {
+      stats.strategy = rle_strategy::run_skip;
+    } else if (stats.run_density < 0.25) {
+      stats.strategy = rle_strategy::literal_copy;
+    } else {
+      stats.strategy = rle_strategy::scan;
+    }
+    return stats;
+  }
+
+  // Returns the index of the first character at or after i that is not
+  // run_char, comparing eight bytes at a time where possible.
+  size_t skip_run(std::string_view s, size_t i, char run_char) {
+    size_t n = s.size();
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const uint64_t pattern = 0x0101010101010101ull * static_cast<unsigned char>(run_char);
+    while (i + 8 <= n) {
+      uint64_t word;
+      std::memcpy(&word, s.data() + i, 8);
+      uint64_t diff = word ^ pattern;
+      if (diff != 0) {
+        return i + __builtin_ctzll(diff) / 8;
+      }
+      i += 8;
+    }
+#endif
+    while (i < n && s[i] == run_char) {
+      i++;
+    }
+    return i;
+  }
+
+  // Run-length-encodes uncompressed with the given kernel; see
+  // run_length_encode.
+  template <typename Alphabet = lowercase_alphabet>
+  std::string run_length_encode_with(std::string_view uncompressed, rle_strategy strategy) {
+    const std::array<char_class, 256>& table = alphabet_table<Alphabet>::value;
+
     std::string C = "";
 
     if (uncompressed.empty()) {
       return C;
     }
 
-    char run_char = uncompressed[0];
+    C.reserve(uncompressed.size());
 
-    int run_length = 1;
+    size_t n = uncompressed.size();
 
-    for (int i = 1; i < uncompressed.size(); i++) {
-      char c = uncompressed[i];
-      if (c == run_char) {
-        run_length++;
-      } else {
-          append_run(C, run_char, run_length);
-          run_char = c;
-          run_length = 1;
+    switch (strategy) {
+    case rle_strategy::scan: {
+      char run_char = uncompressed[0];
+
+      if (table[static_cast<unsigned char>(run_char)] == invalid_char) {
+        throw std::invalid_argument("Invalid Input!");
+      }
+
+      size_t run_length = 1;
+
+      for (size_t i = 1; i < n; i++) {
+        char c = uncompressed[i];
+        if (c == run_char) {
+          run_length++;
+        } else {
+            if (table[static_cast<unsigned char>(c)] == invalid_char) {
+              throw std::invalid_argument("Invalid Input!");
+            }
+            append_run<Alphabet>(C, run_char, run_length);
+            run_char = c;
+            run_length = 1;
+        }
+      }
+
+      append_run<Alphabet>(C, run_char, run_length);
+      break;
+    }
+
+    case rle_strategy::literal_copy: {
+      size_t i = 0;
+      while (i < n) {
+        // extend the literal block up to the next run or escaped character
+        size_t start = i;
+        while (i < n) {
+          char c = uncompressed[i];
+          char_class k = table[static_cast<unsigned char>(c)];
+          if (k == invalid_char) {
+            throw std::invalid_argument("Invalid Input!");
+          }
+          if (k == escaped_char || (i + 1 < n && uncompressed[i + 1] == c)) {
+            break;
+          }
+          i++;
+        }
+        C.append(uncompressed, start, i - start);
+
+        if (i < n) {
+          size_t end = i + 1;
+          while (end < n && uncompressed[end] == uncompressed[i]) {
+            end++;
+          }
+          append_run<Alphabet>(C, uncompressed[i], end - i);
+          i = end;
+        }
+      }
+      break;
+    }
+
+    case rle_strategy::run_skip: {
+      size_t i = 0;
+      while (i < n) {
+        char run_char = uncompressed[i];
+        if (table[static_cast<unsigned char>(run_char)] == invalid_char) {
+          throw std::invalid_argument("Invalid Input!");
+        }
+        size_t end = skip_run(uncompressed, i + 1, run_char);
+        append_run<Alphabet>(C, run_char, end - i);
+        i = end;
       }
+      break;
+    }
     }
 
-    append_run(C, run_char, run_length);
     return C;
   }
 
+  // Samples uncompressed, picks the fastest kernel for its run profile and
+  // encodes with it; inputs shorter than RLE_SAMPLE_MIN_SIZE use scan. If stats is not null, the sample statistics and the
+  // chosen kernel are stored there. The output does not depend on the
+  // kernel.
+  template <typename Alphabet = lowercase_alphabet>
+  std::string run_length_encode(std::string_view uncompressed, rle_stats* stats = nullptr) {
+    // validation is folded into the encoding loop, so this is one phase
+    TRACE_SPAN("run_length_encode");
+
+    rle_stats sample = sample_runs(uncompressed);
+    if (stats != nullptr) {
+      *stats = sample;
+    }
+    return run_length_encode_with<Alphabet>(uncompressed, sample.strategy);
+  }
+
+  // Writes the base-10 representation of count to out and returns the
+  // number of digits written.
+  constexpr size_t write_count(char* out, size_t count) {
+    char digits[20] = {};
+    size_t n = 0;
+    do {
+      digits[n++] = '0' + count % 10;
+      count /= 10;
+    } while (count > 0);
+    for (size_t i = 0; i < n; i++) {
+      out[i] = digits[n - 1 - i];
+    }
+    return n;
+  }
+
+  // Run-length-encodes data[0, size) in place, with the same output as
+  // run_length_encode<Alphabet>, and returns the encoded length.
+  //
+  // Only alphabets without escaped characters are supported, because for
+  // them the encoding is never longer than its input: a run of K >= 2
+  // becomes at most K characters. So the write cursor never passes the
+  // start of the run being read and no unread byte is overwritten.
+  //
+  // Throws std::invalid_argument if the data contains invalid characters.
+  // The whole buffer is validated before anything is written, so on error
+  // it is left unchanged.
+  template <typename Alphabet = lowercase_alphabet>
+  size_t run_length_encode_in_place(char* data, size_t size) {
+    static_assert(!alphabet_table<Alphabet>::has_escapes(),
+                  "in-place encoding needs an alphabet without escaped characters");
+    const std::array<char_class, 256>& table = alphabet_table<Alphabet>::value;
+
+    {
+      TRACE_SPAN("run_length_encode_in_place/validate");
+      for (size_t i = 0; i < size; i++) {
+        if (table[static_cast<unsigned char>(data[i])] == invalid_char) {
+          throw std::invalid_argument("Invalid Input!");
+        }
+      }
+    }
+
+    TRACE_SPAN("run_length_encode_in_place/encode");
+    size_t write = 0, read = 0;
+    while (read < size) {
+      char run_char = data[read];
+      size_t end = read + 1;
+      while (end < size && data[end] == run_char) {
+        end++;
+      }
+      if (end - read > 1) {
+        write += write_count(data + write, end - read);
+      }
+      data[write++] = run_char;
+      read = end;
+    }
+    return write;
+  }
+
+  // Run-length-encodes buffer in place and truncates it to the encoded
+  // length. See run_length_encode_in_place(char*, size_t).
+  template <typename Alphabet = lowercase_alphabet>
+  void run_length_encode_in_place(std::string& buffer) {
+    buffer.resize(run_length_encode_in_place<Alphabet>(&buffer[0], buffer.size()));
+  }
+
+  // A string with a fixed maximum length, held by value so it can be built
+  // at compile time.
+  template <size_t Capacity>
+  struct fixed_string {
+    char data[Capacity + 1] = {};
+    size_t size = 0;
+
+    constexpr std::string_view view() const {
+      return std::string_view(data, size);
+    }
+  };
+
+  // constexpr core of run_length_encode: encodes input into out and
+  // returns the encoded length. out must have room for input.size()
+  // characters, or twice that if Alphabet has escaped characters.
+  //
+  // Throws std::invalid_argument if input contains invalid characters;
+  // in a constant expression that is a compile error.
+  template <typename Alphabet = lowercase_alphabet>
+  constexpr size_t run_length_encode_into(std::string_view input, char* out) {
+    size_t write = 0, read = 0;
+    while (read < input.size()) {
+      char run_char = input[read];
+      char_class k = alphabet_table<Alphabet>::value[static_cast<unsigned char>(run_char)];
+      if (k == invalid_char) {
+        throw std::invalid_argument("Invalid Input!");
+      }
+      size_t end = read + 1;
+      while (end < input.size() && input[end] == run_char) {
+        end++;
+      }
+      if (end - read > 1) {
+        write += write_count(out + write, end - read);
+      }
+      if (k == escaped_char) {
+        out[write++] = RLE_ESCAPE;
+      }
+      out[write++] = run_char;
+      read = end;
+    }
+    return write;
+  }
+
+  // Compile-time run_length_encode of a string literal, e.g.
+  //
+  //    constexpr auto banner = run_length_encode_literal("heloooooooo");
+  //    static_assert(banner.view() == "hel8o");
+  //
+  // An invalid literal is a compile error in a constant expression and
+  // throws std::invalid_argument at run time.
+  template <typename Alphabet = lowercase_alphabet, size_t N>
+  constexpr fixed_string<(alphabet_table<Alphabet>::has_escapes() ? 2 : 1) * (N - 1)>
+  run_length_encode_literal(const char (&input)[N]) {
+    fixed_string<(alphabet_table<Alphabet>::has_escapes() ? 2 : 1) * (N - 1)> C;
+    C.size = run_length_encode_into<Alphabet>(std::string_view(input, N - 1), C.data);
+    return C;
+  }
+
+  // Run-length-encodes every string in inputs in parallel on pool.
+  // Element i of the result is run_length_encode<Alphabet>(inputs[i]).
+  //
+  // Throws std::invalid_argument, once every input has been attempted, if
+  // any input contains invalid characters.
+  template <typename Alphabet = lowercase_alphabet>
+  std::vector<std::string> run_length_encode_batch(ThreadPool& pool, const std::vector<std::string>& inputs) {
+    std::vector<std::string> outputs(inputs.size());
+    parallel_for(pool, 0, inputs.size(), [&](size_t i) {
+      outputs[i] = run_length_encode<Alphabet>(inputs[i]);
+    });
+    return outputs;
+  }
+
+  // Decodes the textual COUNTc form produced by run_length_encode, calling
+  // fn(c, K) once per run in order. Escaped characters ("\c") are accepted
+  // for every alphabet.
+  //
+  // Throws std::invalid_argument if the text is not a valid encoding,
+  // including a count that does not fit in 64 bits.
+  template <typename Function>
+  void for_each_text_run(const std::string& text, Function fn) {
+    size_t i = 0;
+    while (i < text.size()) {
+      uint64_t count = 0;
+      bool has_count = false;
+      while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+        unsigned digit = text[i] - '0';
+        if (count > (UINT64_MAX - digit) / 10) {
+          throw std::invalid_argument("Malformed run-length encoding.");
+        }
+        count = count * 10 + digit;
+        has_count = true;
+        i++;
+      }
+
+      if (i < text.size() && text[i] == RLE_ESCAPE) {
+        i++;
+      }
+
+      if (i == text.size() || (has_count && count == 0)) {
+        throw std::invalid_argument("Malformed run-length encoding.");
+      }
+
+      fn(text[i], has_count ? count : 1);
+      i++;
+    }
+  }
+
+  // Inverse of run_length_encode.
+  std::string run_length_decode(const std::string& encoded) {
+    std::string D = "";
+    for_each_text_run(encoded, [&](char c, uint64_t count) {
+      D.append(count, c);
+    });
+    return D;
+  }
+
+  // Binary run-length encoding.
+  //
+  // The textual COUNTc form spends one byte per decimal digit of every
+  // count and needs decimal conversion to read back. The packed form
+  // stores each run as its byte followed by its length in unsigned LEB128,
+  // so a run of a few million costs 4 bytes. Layout:
+  //
+  //   "RLE\x01"       magic and format version
+  //   length          LEB128, characters in the original string
+  //   runs            LEB128, number of runs
+  //   block_runs      LEB128, runs per index block, 0 if there is no index
+  //   index           one entry per block of block_runs runs, each entry two
+  //                   little-endian uint64 values: the logical offset of
+  //                   the block's first character and the offset of its
+  //                   first run from the start of the payload
+  //   payload         runs (byte, LEB128 length) pairs
+  //
+  // The index is fixed-width so a reader can binary search it in place.
+
+  const char RLE_PACKED_MAGIC[4] = { 'R', 'L', 'E', '\x01' };
+
+  // Decoding reserves at most this many characters per payload byte up
+  // front. Streams that decode to more have long runs, which are appended
+  // in few, large steps anyway.
+  const uint64_t RLE_PACKED_RESERVE_PER_BYTE = 64;
+
+  struct rle_packed_header {
+    uint64_t length;      // characters in the original string
+    uint64_t runs;        // number of runs in the payload
+    uint64_t block_runs;  // runs per index block, 0 if there is no index
+    size_t index_pos;     // byte offset of the first index entry
+    size_t payload_pos;   // byte offset of the first run
+  };
+
+  void append_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+      out += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    out += static_cast<char>(value);
+  }
+
+  // Reads a LEB128 value starting at pos and advances pos past it.
+  //
+  // Throws std::invalid_argument if the value is truncated or overflows.
+  uint64_t read_varint(const std::string& in, size_t& pos) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (pos >= in.size()) {
+        throw std::invalid_argument("Truncated varint in packed RLE data.");
+      }
+      unsigned char byte = in[pos++];
+      if (shift == 63 && (byte & 0x7E) != 0) {
+        throw std::invalid_argument("Varint overflow in packed RLE data.");
+      }
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw std::invalid_argument("Varint overflow in packed RLE data.");
+  }
+
+  void append_uint64_le(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      out += static_cast<char>(value >> (8 * i));
+    }
+  }
+
+  uint64_t read_uint64_le(const std::string& in, size_t pos) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+    }
+    return value;
+  }
+
+  // Parses and validates the header of packed RLE data.
+  //
+  // Throws std::invalid_argument if the header is malformed.
+  rle_packed_header read_rle_packed_header(const std::string& packed) {
+    if (packed.size() < sizeof(RLE_PACKED_MAGIC) ||
+        packed.compare(0, sizeof(RLE_PACKED_MAGIC), RLE_PACKED_MAGIC, sizeof(RLE_PACKED_MAGIC)) != 0) {
+      throw std::invalid_argument("Not packed RLE data.");
+    }
+
+    rle_packed_header header;
+    size_t pos = sizeof(RLE_PACKED_MAGIC);
+    header.length = read_varint(packed, pos);
+    header.runs = read_varint(packed, pos);
+    header.block_runs = read_varint(packed, pos);
+    header.index_pos = pos;
+
+    uint64_t blocks = 0;
+    if (header.block_runs > 0) {
+      blocks = header.runs / header.block_runs + (header.runs % header.block_runs != 0);
+    }
+    if (blocks > (packed.size() - pos) / 16) {
+      throw std::invalid_argument("Truncated index in packed RLE data.");
+    }
+    header.payload_pos = pos + blocks * 16;
+
+    // every run takes at least two payload bytes and one character, so
+    // callers may size buffers by runs once this holds
+    if (header.runs > (packed.size() - header.payload_pos) / 2 ||
+        header.length < header.runs || (header.runs == 0) != (header.length == 0)) {
+      throw std::invalid_argument("Packed RLE data does not match its header.");
+    }
+    return header;
+  }
+
+  // Calls fn(c, K) for every run in packed RLE data, in order, checking
+  // each block index entry against the runs it points at.
+  //
+  // Throws std::invalid_argument if the data is malformed.
+  template <typename Function>
+  void for_each_packed_run(const std::string& packed, Function fn) {
+    rle_packed_header header = read_rle_packed_header(packed);
+    size_t pos = header.payload_pos;
+    uint64_t total = 0;
+    for (uint64_t r = 0; r < header.runs; r++) {
+      if (header.block_runs > 0 && r % header.block_runs == 0) {
+        size_t entry = header.index_pos + (r / header.block_runs) * 16;
+        if (read_uint64_le(packed, entry) != total ||
+            read_uint64_le(packed, entry + 8) != pos - header.payload_pos) {
+          throw std::invalid_argument("Packed RLE index does not match its payload.");
+        }
+      }
+      if (pos >= packed.size()) {
+        throw std::invalid_argument("Truncated payload in packed RLE data.");
+      }
+      char c = packed[pos++];
+      uint64_t count = read_varint(packed, pos);
+      if (count == 0) {
+        throw std::invalid_argument("Empty run in packed RLE data.");
+      }
+      // checked before fn sees the run, so a lying header cannot make a
+      // caller append more than the length it declares
+      if (count > header.length - total) {
+        throw std::invalid_argument("Packed RLE data does not match its header.");
+      }
+      total += count;
+      fn(c, count);
+    }
+    if (total != header.length || pos != packed.size()) {
+      throw std::invalid_argument("Packed RLE data does not match its header.");
+    }
+  }
+
+  // Builds packed RLE data from a run source. for_each_run(emit) must call
+  // emit(c, K) once per run, in order.
+  template <typename RunSource>
+  std::string pack_runs(RunSource for_each_run, uint64_t block_runs) {
+    std::string payload;
+    std::vector<uint64_t> index;
+    uint64_t length = 0, runs = 0;
+
+    for_each_run([&](char c, uint64_t count) {
+      if (block_runs > 0 && runs % block_runs == 0) {
+        index.push_back(length);
+        index.push_back(payload.size());
+      }
+      if (count > UINT64_MAX - length) {
+        throw std::invalid_argument("Run-length encoding longer than 2^64 characters.");
+      }
+      payload += c;
+      append_varint(payload, count);
+      length += count;
+      runs++;
+    });
+
+    std::string P(RLE_PACKED_MAGIC, sizeof(RLE_PACKED_MAGIC));
+    append_varint(P, length);
+    append_varint(P, runs);
+    append_varint(P, block_runs);
+    P.reserve(P.size() + index.size() * 8 + payload.size());
+    for (uint64_t value : index) {
+      append_uint64_le(P, value);
+    }
+    P += payload;
+    return P;
+  }
+
+  // Run-length-encodes uncompressed into the packed binary form.
+  //
+  // Every byte value is accepted and every maximal run, including runs of
+  // one, is stored. If block_runs is positive an index entry is written
+  // for every block_runs runs.
+  std::string run_length_encode_packed(const std::string& uncompressed, uint64_t block_runs = 0) {
+    return pack_runs([&](auto emit) {
+      size_t i = 0;
+      while (i < uncompressed.size()) {
+        size_t j = i + 1;
+        while (j < uncompressed.size() && uncompressed[j] == uncompressed[i]) {
+          j++;
+        }
+        emit(uncompressed[i], j - i);
+        i = j;
+      }
+    }, block_runs);
+  }
+
+  // Inverse of run_length_encode_packed.
+  //
+  // Throws std::invalid_argument if packed is malformed.
+  std::string run_length_decode_packed(const std::string& packed) {
+    rle_packed_header header = read_rle_packed_header(packed);
+    std::string D = "";
+    D.reserve(std::min<uint64_t>(header.length,
+                                 (packed.size() - header.payload_pos) * RLE_PACKED_RESERVE_PER_BYTE));
+    for_each_packed_run(packed, [&](char c, uint64_t count) {
+      D.append(count, c);
+    });
+    return D;
+  }
+
+  // Converts run_length_encode output to the packed form without
+  // decompressing it.
+  //
+  // Throws std::invalid_argument if text is not a valid encoding.
+  std::string rle_text_to_packed(const std::string& text, uint64_t block_runs = 0) {
+    return pack_runs([&](auto emit) {
+      for_each_text_run(text, emit);
+    }, block_runs);
+  }
+
+  // Converts packed RLE data to the textual form run_length_encode<Alphabet>
+  // would produce.
+  //
+  // Throws std::invalid_argument if packed is malformed or contains a
+  // character outside Alphabet.
+  template <typename Alphabet = lowercase_alphabet>
+  std::string rle_packed_to_text(const std::string& packed) {
+    const std::array<char_class, 256>& table = alphabet_table<Alphabet>::value;
+    std::string C = "";
+    for_each_packed_run(packed, [&](char c, uint64_t count) {
+      if (table[static_cast<unsigned char>(c)] == invalid_char) {
+        throw std::invalid_argument("Invalid Input!");
+      }
+      append_run<Alphabet>(C, c, count);
+    });
+    return C;
+  }
+
+  // Logical offset and byte position of the first run of the index block
+  // that holds character i, found by binary searching the index in place.
+  // Without an index this is the first run of the payload.
+  //
+  // Throws std::invalid_argument if the entry found points outside the
+  // payload.
+  std::pair<uint64_t, size_t> seek_packed_block(const std::string& packed,
+                                                const rle_packed_header& header, uint64_t i) {
+    size_t blocks = (header.payload_pos - header.index_pos) / 16;
+    size_t low = 0, high = blocks;  // first entry starting after i
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      if (read_uint64_le(packed, header.index_pos + mid * 16) <= i) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (low == 0) {
+      return { 0, header.payload_pos };
+    }
+    size_t entry = header.index_pos + (low - 1) * 16;
+    uint64_t run_pos = read_uint64_le(packed, entry + 8);
+    if (run_pos >= packed.size() - header.payload_pos) {
+      throw std::invalid_argument("Packed RLE index does not match its payload.");
+    }
+    return { read_uint64_le(packed, entry), header.payload_pos + run_pos };
+  }
+
+  // Returns characters [begin, end) of the string packed encodes, seeking
+  // through the block index so only the runs of the blocks that overlap
+  // the range are decoded. Lookups trust the index entry they land on;
+  // for_each_packed_run validates the whole index.
+  //
+  // Throws std::out_of_range if begin > end or end is past the decoded
+  // length, and std::invalid_argument if packed is malformed.
+  std::string rle_packed_extract(const std::string& packed, uint64_t begin, uint64_t end) {
+    rle_packed_header header = read_rle_packed_header(packed);
+    if (begin > end || end > header.length) {
+      throw std::out_of_range("rle_packed_extract");
+    }
+    std::string S = "";
+    if (begin == end) {
+      return S;
+    }
+    S.reserve(end - begin);
+
+    std::pair<uint64_t, size_t> start = seek_packed_block(packed, header, begin);
+    uint64_t offset = start.first;
+    size_t pos = start.second;
+    while (offset < end) {
+      if (pos >= packed.size()) {
+        throw std::invalid_argument("Truncated payload in packed RLE data.");
+      }
+      char c = packed[pos++];
+      uint64_t count = read_varint(packed, pos);
+      if (count == 0 || count > header.length - offset) {
+        throw std::invalid_argument("Packed RLE data does not match its header.");
+      }
+      uint64_t stop = std::min(end, offset + count);
+      if (stop > begin) {
+        S.append(stop - std::max(begin, offset), c);
+      }
+      offset += count;
+    }
+    return S;
+  }
+
+  // Returns character i of the string packed encodes; see
+  // rle_packed_extract.
+  //
+  // Throws std::out_of_range if i is past the decoded length, and
+  // std::invalid_argument if packed is malformed.
+  char rle_packed_at(const std::string& packed, uint64_t i) {
+    if (i == UINT64_MAX) {
+      throw std::out_of_range("rle_packed_at");
+    }
+    return rle_packed_extract(packed, i, i + 1)[0];
+  }
+
+  // Random-access index over run-length-encoded data.
+  //
+  // Stores the character and cumulative end offset of every run, plus a
+  // sample of the end offset of every SAMPLE_RUNS-th run. A lookup binary
+  // searches the small sample array first and then a single block of
+  // SAMPLE_RUNS offsets, so both searches stay within a few cache lines
+  // and take O(log runs) time.
+  //
+  // How to use:
+  //
+  //    RleIndex index = RleIndex::from_text(run_length_encode(s));
+  //    char c = index.at(i);                   // == s[i]
+  //    std::string part = index.extract(i, j); // == s.substr(i, j - i)
+  //
+  // Packed data written with a block index can also be read in place with
+  // rle_packed_at and rle_packed_extract, without building an RleIndex.
+  //
+  class RleIndex {
+  public:
+    static const size_t SAMPLE_RUNS = 64;
+
+  private:
+    std::vector<char> _chars;       // character of each run
+    std::vector<uint64_t> _ends;    // offset one past the end of each run
+    std::vector<uint64_t> _samples; // _ends of the last run in each block
+
+    RleIndex() { }
+
+    void add_run(char c, uint64_t count) {
+      uint64_t start = _ends.empty() ? 0 : _ends.back();
+      if (count > UINT64_MAX - start) {
+        throw std::invalid_argument("Run-length encoding longer than 2^64 characters.");
+      }
+      uint64_t end = start + count;
+      _chars.push_back(c);
+      _ends.push_back(end);
+      if (_ends.size() % SAMPLE_RUNS == 0) {
+        _samples.push_back(end);
+      }
+    }
+
+    void finish() {
+      if (_ends.size() % SAMPLE_RUNS != 0) {
+        _samples.push_back(_ends.back());
+      }
+    }
+
+    // Index of the run containing character i; i must be < size().
+    size_t find_run(uint64_t i) const {
+      size_t block = std::upper_bound(_samples.begin(), _samples.end(), i) - _samples.begin();
+      std::vector<uint64_t>::const_iterator first = _ends.begin() + block * SAMPLE_RUNS,
+        last = _ends.begin() + std::min(_ends.size(), (block + 1) * SAMPLE_RUNS);
+      return std::upper_bound(first, last, i) - _ends.begin();
+    }
+
+  public:
+
+    // Builds an index over run_length_encode output.
+    //
+    // Throws std::invalid_argument if encoded is not a valid encoding.
+    static RleIndex from_text(const std::string& encoded) {
+      RleIndex index;
+      for_each_text_run(encoded, [&](char c, uint64_t count) {
+        index.add_run(c, count);
+      });
+      index.finish();
+      return index;
+    }
+
+    // Builds an index over run_length_encode_packed output.
+    //
+    // Throws std::invalid_argument if packed is malformed.
+    static RleIndex from_packed(const std::string& packed) {
+      RleIndex index;
+      uint64_t runs = read_rle_packed_header(packed).runs;
+      index._chars.reserve(runs);
+      index._ends.reserve(runs);
+      for_each_packed_run(packed, [&](char c, uint64_t count) {
+        index.add_run(c, count);
+      });
+      index.finish();
+      return index;
+    }
+
+    // Length of the decoded string.
+    uint64_t size() const {
+      return _ends.empty() ? 0 : _ends.back();
+    }
+
+    // Number of runs.
+    size_t runs() const {
+      return _ends.size();
+    }
+
+    // Returns character i of the decoded string.
+    //
+    // Throws std::out_of_range if i >= size().
+    char at(uint64_t i) const {
+      if (i >= size()) {
+        throw std::out_of_range("RleIndex::at");
+      }
+      return _chars[find_run(i)];
+    }
+
+    // Returns characters [begin, end) of the decoded string.
+    //
+    // Throws std::out_of_range if begin > end or end > size().
+    std::string extract(uint64_t begin, uint64_t end) const {
+      if (begin > end || end > size()) {
+        throw std::out_of_range("RleIndex::extract");
+      }
+      std::string S = "";
+      S.reserve(end - begin);
+      for (size_t r = (begin < end) ? find_run(begin) : runs(); begin < end; r++) {
+        uint64_t stop = std::min(end, _ends[r]);
+        S.append(stop - begin, _chars[r]);
+        begin = stop;
+      }
+      return S;
+    }
+  };
+
   // Returns the longest substring of text, such that every character in the
   // substring appears at least k times in text.
   // If there are ties, the substring that appears first is returned.
   std::string longest_frequent_substring(const std::string& text, unsigned k) {
+    TRACE_SPAN("longest_frequent_substring");
+
     if (k <= 1) {
       return text;
     }
@@ -114,6 +1007,337 @@ namespace algorithms {
     return best;
   }
 
+  // Runs longest_frequent_substring on every (text, k) pair in queries in
+  // parallel on pool.
+  std::vector<std::string> longest_frequent_substring_batch(ThreadPool& pool,
+      const std::vector<std::pair<std::string, unsigned>>& queries) {
+    std::vector<std::string> outputs(queries.size());
+    parallel_for(pool, 0, queries.size(), [&](size_t i) {
+      outputs[i] = longest_frequent_substring(queries[i].first, queries[i].second);
+    });
+    return outputs;
+  }
+
+  // A substring identified by its position, [offset, offset + length).
+  struct text_segment {
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  // Returns which byte values occur in a text at least k times, given the
+  // text's character histogram.
+  std::array<bool, 256> frequent_characters(const std::array<uint64_t, 256>& histogram, unsigned k) {
+    std::array<bool, 256> frequent;
+    for (size_t c = 0; c < 256; c++) {
+      frequent[c] = (histogram[c] > 0 && histogram[c] >= k);
+    }
+    return frequent;
+  }
+
+  // Finds the maximal segments of a text in which every character appears
+  // at least k times in the whole text, given the text's character
+  // histogram. The text is fed in blocks of any size, so it never has to
+  // be in memory at once.
+  //
+  // How to use:
+  //
+  //    SegmentScanner scanner(histogram, k);
+  //    scanner.feed(block, block_size, on_segment); // once per block, in order
+  //    scanner.finish(on_segment);
+  //
+  // on_segment(text_segment) is called once per non-empty maximal segment,
+  // in order of offset.
+  class SegmentScanner {
+  private:
+    std::array<bool, 256> _frequent;
+    uint64_t _position = 0; // offset of the next character fed
+    uint64_t _start = 0;    // offset of the first character of the open segment
+    bool _open = false;
+
+  public:
+    SegmentScanner(const std::array<uint64_t, 256>& histogram, unsigned k)
+      : _frequent(frequent_characters(histogram, k)) { }
+
+    template <typename Function>
+    void feed(const char* block, size_t size, Function on_segment) {
+      for (size_t i = 0; i < size; i++, _position++) {
+        bool frequent = _frequent[static_cast<unsigned char>(block[i])];
+        if (frequent && !_open) {
+          _start = _position;
+          _open = true;
+        } else if (!frequent && _open) {
+          on_segment(text_segment{ _start, _position - _start });
+          _open = false;
+        }
+      }
+    }
+
+    template <typename Function>
+    void finish(Function on_segment) {
+      if (_open) {
+        on_segment(text_segment{ _start, _position - _start });
+        _open = false;
+      }
+    }
+  };
+
+  // Every maximal segment of text in which each character appears at least
+  // k times in text, as a range that is scanned lazily: building the range
+  // costs one histogram pass, and each increment of the iterator scans
+  // only up to the end of the next segment. No strings are materialized.
+  // text must outlive the range.
+  //
+  // How to use:
+  //
+  //    for (text_segment s : FrequentSegments(text, k)) {
+  //      // text.substr(s.offset, s.length) is a maximal segment
+  //    }
+  //
+  class FrequentSegments {
+  private:
+    std::string_view _text;
+    std::array<bool, 256> _frequent;
+
+    bool frequent(size_t i) const {
+      return _frequent[static_cast<unsigned char>(_text[i])];
+    }
+
+    // The first segment starting at or after position, or an empty
+    // segment at the end of the text if there is none.
+    text_segment next_from(size_t position) const {
+      while (position < _text.size() && !frequent(position)) {
+        position++;
+      }
+      size_t end = position;
+      while (end < _text.size() && frequent(end)) {
+        end++;
+      }
+      return text_segment{ position, end - position };
+    }
+
+  public:
+    class iterator {
+    private:
+      const FrequentSegments* _range;
+      text_segment _segment;
+
+    public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = text_segment;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const text_segment*;
+      using reference = const text_segment&;
+
+      iterator(const FrequentSegments* range, text_segment segment)
+        : _range(range), _segment(segment) { }
+
+      reference operator*() const {
+        return _segment;
+      }
+
+      pointer operator->() const {
+        return &_segment;
+      }
+
+      iterator& operator++() {
+        _segment = _range->next_from(_segment.offset + _segment.length);
+        return *this;
+      }
+
+      iterator operator++(int) {
+        iterator before = *this;
+        ++*this;
+        return before;
+      }
+
+      bool operator==(const iterator& other) const {
+        return _segment.offset == other._segment.offset;
+      }
+
+      bool operator!=(const iterator& other) const {
+        return !(*this == other);
+      }
+    };
+
+    FrequentSegments(std::string_view text, unsigned k) : _text(text) {
+      std::array<uint64_t, 256> histogram{};
+      for (char c : text) {
+        histogram[static_cast<unsigned char>(c)]++;
+      }
+      _frequent = frequent_characters(histogram, k);
+    }
+
+    iterator begin() const {
+      return iterator(this, next_from(0));
+    }
+
+    iterator end() const {
+      return iterator(this, text_segment{ _text.size(), 0 });
+    }
+  };
+
+  // Returns up to count of the longest maximal segments of text in which
+  // every character appears at least k times in text, longest first, with
+  // ties in order of offset. The first element is the substring
+  // longest_frequent_substring returns.
+  //
+  // Makes one pass over the segments, keeping the best count of them in a
+  // bounded min-heap.
+  std::vector<text_segment> longest_frequent_segments(const std::string& text, unsigned k, size_t count) {
+    // true if a should be ranked before b
+    auto better = [](const text_segment& a, const text_segment& b) {
+      return a.length > b.length || (a.length == b.length && a.offset < b.offset);
+    };
+
+    // the top of the heap is the worst segment kept so far
+    std::priority_queue<text_segment, std::vector<text_segment>, decltype(better)> heap(better);
+
+    if (count > 0) {
+      for (text_segment segment : FrequentSegments(text, k)) {
+        if (heap.size() < count) {
+          heap.push(segment);
+        } else if (better(segment, heap.top())) {
+          heap.pop();
+          heap.push(segment);
+        }
+      }
+    }
+
+    std::vector<text_segment> best(heap.size());
+    for (size_t i = heap.size(); i > 0; i--) {
+      best[i - 1] = heap.top();
+      heap.pop();
+    }
+    return best;
+  }
+
+  // Closes a POSIX file descriptor when it goes out of scope.
+  struct file_descriptor {
+    int fd;
+
+    explicit file_descriptor(int fd) : fd(fd) { }
+    file_descriptor(const file_descriptor&) = delete;
+    file_descriptor& operator=(const file_descriptor&) = delete;
+
+    ~file_descriptor() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  };
+
+  // Reads size bytes at offset into out, retrying short reads.
+  //
+  // Throws std::system_error on an I/O error or premature end of file.
+  void pread_fully(int fd, char* out, size_t size, uint64_t offset, const std::string& path) {
+    while (size > 0) {
+      ssize_t got = ::pread(fd, out, size, offset);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= 0) {
+        throw std::system_error(got < 0 ? errno : EIO, std::generic_category(), path);
+      }
+      out += got;
+      size -= got;
+      offset += got;
+    }
+  }
+
+  // Calls fn(block, size) for consecutive blocks of the file open as fd,
+  // starting from the beginning, reading block_size bytes at a time into
+  // buffer.
+  //
+  // Throws std::system_error on an I/O error.
+  template <typename Function>
+  void for_each_file_block(int fd, std::vector<char>& buffer, const std::string& path, Function fn) {
+    uint64_t offset = 0;
+    while (true) {
+      ssize_t got = ::pread(fd, buffer.data(), buffer.size(), offset);
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+      }
+      if (got == 0) {
+        return;
+      }
+      fn(buffer.data(), static_cast<size_t>(got));
+      offset += got;
+    }
+  }
+
+  // Out-of-core version of longest_frequent_substring for files larger
+  // than memory.
+  //
+  // Streams the file twice, block_size bytes at a time: once to build the
+  // character histogram, then again to find the first longest maximal
+  // segment of frequent characters, tracking only its offset and length.
+  // Only the winning segment is read back. Apart from the result, memory
+  // use is one block plus a 256-entry histogram.
+  //
+  // Returns the position of the substring longest_frequent_substring would
+  // return for the file's contents.
+  //
+  // Throws std::system_error if the file cannot be read.
+  text_segment longest_frequent_segment_file(const std::string& path, unsigned k,
+                                             size_t block_size = 1 << 20) {
+    file_descriptor file(::open(path.c_str(), O_RDONLY));
+    if (file.fd < 0) {
+      throw std::system_error(errno, std::generic_category(), path);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    std::vector<char> buffer(std::max<size_t>(block_size, 1));
+
+    std::array<uint64_t, 256> histogram{};
+    {
+      TRACE_SPAN("longest_frequent_segment_file/histogram");
+      for_each_file_block(file.fd, buffer, path, [&](const char* block, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+          histogram[static_cast<unsigned char>(block[i])]++;
+        }
+      });
+    }
+
+    TRACE_SPAN("longest_frequent_segment_file/segments");
+    text_segment best{ 0, 0 };
+    auto keep_longest = [&](text_segment segment) {
+      if (segment.length > best.length) {
+        best = segment;
+      }
+    };
+    SegmentScanner scanner(histogram, k);
+    for_each_file_block(file.fd, buffer, path, [&](const char* block, size_t size) {
+      scanner.feed(block, size, keep_longest);
+    });
+    scanner.finish(keep_longest);
+    return best;
+  }
+
+  // Out-of-core longest_frequent_substring; see
+  // longest_frequent_segment_file. Reads back only the winning substring.
+  //
+  // Throws std::system_error if the file cannot be read.
+  std::string longest_frequent_substring_file(const std::string& path, unsigned k,
+                                              size_t block_size = 1 << 20) {
+    text_segment best = longest_frequent_segment_file(path, k, block_size);
+
+    TRACE_SPAN("longest_frequent_substring_file/read_back");
+    std::string S(best.length, '\0');
+    if (best.length > 0) {
+      file_descriptor file(::open(path.c_str(), O_RDONLY));
+      if (file.fd < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+      }
+      pread_fully(file.fd, &S[0], S.size(), best.offset, path);
+    }
+    return S;
+  }
+
   // Reformats a string containing a date into YYYY-MM-DD format.
   //
   // input may be formatted in one of four patterns:
@@ -136,7 +1360,8 @@ namespace algorithms {
   //
   // Any leading spaces or trailing spaces are ignored.
   //
-  // Returns a string in strict YYYY-MM-DD format.
+  // Returns a string in strict YYYY-MM-DD format. reformat_date_packed and
+  // reformat_date_days return the same date as an integer instead.
   //
   // Throws std::invalid argument if:
   // - input does not fit any of the four patterns
@@ -145,131 +1370,317 @@ namespace algorithms {
   // - DAY is not in the range [1, 31]
   // - YEAR is not in the range [1900, 2099]
 
-  // Helper function for reformat_date()
-  std::string verify_format(std::string& year, std::string& month, std::string& day) {
-    std::map<std::string, std::string> months = {
-      {"january", "01"}, {"february", "02"}, {"march", "03"},
-      {"april", "04"}, {"may", "05"}, {"june", "06"},
-      {"july", "07"}, {"august", "08"}, {"september", "09"},
-      {"october", "10"}, {"november", "11"}, {"december", "12"} };
+  // Helper functions for reformat_date()
+  //
+  // These work on std::string_view slices of the input and never allocate,
+  // so reformat_date performs no heap allocation on valid input. They are
+  // all constexpr, so dates can also be parsed at compile time; see
+  // parse_date.
+
+  constexpr std::string_view MONTH_NAMES[12] = {
+    "january", "february", "march", "april", "may", "june",
+    "july", "august", "september", "october", "november", "december" };
 
-    std::map<std::string, std::string> month_abbr = {
-      {"jan", "01"}, {"feb", "02"}, {"mar", "03"}, {"apr", "04"},
-      {"may", "05"}, {"jun", "06"}, {"jul", "07"}, {"aug", "08"},
-      {"sep", "09"}, {"oct", "10"}, {"nov", "11"}, {"dec", "12"} };
+  constexpr std::string_view MONTH_ABBREVIATIONS[12] = {
+    "jan", "feb", "mar", "apr", "may", "jun",
+    "jul", "aug", "sep", "oct", "nov", "dec" };
 
-    std::string D = "";
+  // The longest pattern, Y-M-D or M/D/Y, has five tokens.
+  const size_t MAX_DATE_TOKENS = 5;
 
+  constexpr bool is_date_delimiter(char c) {
+    return c == '-' || c == '/' || c == ',';
+  }
+
+  // Returns the value of a field made only of decimal digits, or -1 if
+  // field is empty or contains anything else.
+  constexpr int parse_date_number(std::string_view field) {
+    if (field.empty() || field.size() > 4) {
+      return -1;
+    }
+    int value = 0;
+    for (char c : field) {
+      if (c < '0' || c > '9') {
+        return -1;
+      }
+      value = value * 10 + (c - '0');
+    }
+    return value;
+  }
+
+  // std::tolower is not constexpr.
+  constexpr char ascii_to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+  }
+
+  // Returns the 1-based index of field in names, compared
+  // case-insensitively, or 0 if it is not there.
+  constexpr int find_month(std::string_view field, const std::string_view (&names)[12]) {
+    for (int m = 0; m < 12; m++) {
+      if (field.size() != names[m].size()) {
+        continue;
+      }
+      bool match = true;
+      for (size_t i = 0; i < field.size() && match; i++) {
+        match = (ascii_to_lower(field[i]) == names[m][i]);
+      }
+      if (match) {
+        return m + 1;
+      }
+    }
+    return 0;
+  }
+
+  // Packed dates.
+  //
+  // A packed date is the 32-bit value year<<9 | month<<5 | day: day in the
+  // low five bits, month in the next four, year above them.
+
+  constexpr uint32_t pack_date(int year, int month, int day) {
+    return static_cast<uint32_t>(year) << 9 | static_cast<uint32_t>(month) << 5 | static_cast<uint32_t>(day);
+  }
+
+  constexpr int packed_year(uint32_t packed) {
+    return packed >> 9;
+  }
+
+  constexpr int packed_month(uint32_t packed) {
+    return (packed >> 5) & 0xF;
+  }
+
+  constexpr int packed_day(uint32_t packed) {
+    return packed & 0x1F;
+  }
+
+  constexpr void write_two_digits(char* out, int value) {
+    out[0] = '0' + value / 10;
+    out[1] = '0' + value % 10;
+  }
+
+  // Writes packed as the ten characters YYYY-MM-DD to out. No terminator
+  // is written.
+  constexpr void format_packed_date(uint32_t packed, char* out) {
+    int y = packed_year(packed);
+    write_two_digits(out, y / 100);
+    write_two_digits(out + 2, y % 100);
+    out[4] = '-';
+    write_two_digits(out + 5, packed_month(packed));
+    out[7] = '-';
+    write_two_digits(out + 8, packed_day(packed));
+  }
+
+  // Number of days from 1900-01-01 to packed, which may be negative for
+  // earlier dates. Days past the end of a month, which reformat_date
+  // accepts because it only checks DAY against [1, 31], roll over into the
+  // next month, so "February 31" counts the same as "March 3" in a common
+  // year.
+  constexpr int32_t packed_date_to_days(uint32_t packed) {
+    // days_from_civil, with the year starting in March so the leap day
+    // comes last
+    int y = packed_year(packed), m = packed_month(packed), d = packed_day(packed);
+    y -= (m <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int year_of_era = y - era * 400;
+    int day_of_year = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int days_since_epoch = era * 146097 + day_of_era - 719468; // since 1970-01-01
+    return days_since_epoch + 25567;                            // since 1900-01-01
+  }
+
+  // Validates the three fields of a date and returns it packed; see
+  // pack_date.
+  constexpr uint32_t verify_format(std::string_view year, std::string_view month, std::string_view day) {
     int y = 0;
 
     if (year.size() == 4) {
-      y = std::stoi(year);
+      y = parse_date_number(year);
     }
 
     if (y < 1900 || y > 2099) {
       throw std::invalid_argument("Year is not in the range [1900, 2099].");
-    } else {
-      D = year + "-";
     }
 
-    for (int i = 0; i < month.size(); i++) {
-      month[i] = std::tolower(month[i]);
-    }
+    int m = 0;
 
     if (month.size() == 2 || month.size() == 1) {
-
-      if (month.size() == 1) {
-        month = month.insert(0, "0");
-      }
-
-      int m = std::stoi(month);
+      m = parse_date_number(month);
 
       if (m < 1 || m > 12) {
         throw std::invalid_argument("M is not in the range [1, 12]");
-      } else {
-        D = D + month + "-";
       }
     } else if (month.size() == 3) {
-      std::map<std::string, std::string>::iterator iter = month_abbr.find(month);
+      m = find_month(month, MONTH_ABBREVIATIONS);
 
-      if (iter != month_abbr.end()) {
-        D = D + month_abbr[month] + "-";
-      } else {
+      if (m == 0) {
         throw std::invalid_argument("MON is not a valid month abbreviation.");
       }
-    } else if (month.size() > 3) {
-        std::map<std::string, std::string>::iterator iter = months.find(month);
-        if (iter != months.end()) {
-          D = D + months[month] + "-";
-        } else {
-          throw std::invalid_argument("MONTH is not a valid month name");
-        }
-    }
+    } else {
+      m = find_month(month, MONTH_NAMES);
 
-    if (day.size() == 1) {
-      day = day.insert(0, "0");
+      if (m == 0) {
+        throw std::invalid_argument("MONTH is not a valid month name");
+      }
     }
 
     int d = 0;
 
-    if (day.size() == 2) {
-      d = std::stoi(day);
+    if (day.size() == 2 || day.size() == 1) {
+      d = parse_date_number(day);
     }
 
     if (d < 1 || d > 31) {
       throw std::invalid_argument("DAY is not in the range [1, 31]");
-    } else {
-      D = D + day;
     }
 
-    return D;
+    return pack_date(y, m, d);
   }
 
-  std::string reformat_date(const std::string& input) {
-    std::string D, substring = "";
-
-    std::vector<std::string> parts;
+  // The fields and single-character delimiter tokens of a date string.
+  struct date_tokens {
+    std::array<std::string_view, MAX_DATE_TOKENS> parts{};
+    size_t count = 0;
+  };
 
-    int delimiter_count = 0;
+  // Splits input into fields and single-character delimiter tokens.
+  // Spaces only separate tokens.
+  //
+  // Throws std::invalid_argument if there are more tokens than any
+  // pattern has.
+  constexpr date_tokens tokenize_date(std::string_view input) {
+    date_tokens tokens;
 
-    for (int i = 0; i < input.size(); i++) {
-      char c = input[i];
+    size_t i = 0;
+    while (i < input.size()) {
+      if (input[i] == ' ') {
+        i++;
+        continue;
+      }
 
-      if ((i == input.size() - 1) && (c != ' ')) {
-        substring += c;
-        parts.push_back(substring);
+      if (tokens.count == tokens.parts.size()) {
+        throw std::invalid_argument("Input does not fit pattern 1, 2, 3, or 4.");
       }
 
-      if (c == '-' || c == '/' || c == ',' || c == ' ') {
-        if (substring != "") {
-          parts.push_back(substring);
+      size_t j = i + 1;
+      if (!is_date_delimiter(input[i])) {
+        while (j < input.size() && input[j] != ' ' && !is_date_delimiter(input[j])) {
+          j++;
         }
+      }
 
-        if (c != ' ') {
-          delimiter_count++;
-          parts.push_back(std::string(1, c));
-        }
+      tokens.parts[tokens.count++] = input.substr(i, j - i);
+      i = j;
+    }
+    return tokens;
+  }
 
-        substring = "";
-      } else {
-        substring += c;
-      }
+  // Matches tokens against the four patterns and returns the packed date.
+  //
+  // Throws std::invalid_argument in the same cases as reformat_date.
+  constexpr uint32_t verify_tokens(const date_tokens& tokens) {
+    const std::array<std::string_view, MAX_DATE_TOKENS>& parts = tokens.parts;
+
+    if (tokens.count == 4 && parts[2] == ",") {
+      return verify_format(parts[3], parts[0], parts[1]);
+    } else if (tokens.count == 5 && parts[1] == "-" && parts[3] == "-") {
+      return verify_format(parts[0], parts[2], parts[4]);
+    } else if (tokens.count == 5 && parts[1] == "/" && parts[3] == "/") {
+      return verify_format(parts[4], parts[0], parts[2]);
     }
 
-    if (delimiter_count < 1 || parts.size() < 4) {
-      throw std::invalid_argument("Input does not fit pattern 1, 2, 3, or 4.");
+    throw std::invalid_argument("Input does not fit pattern 1, 2, 3, or 4.");
+  }
+
+  // Parses a date in any of the four patterns accepted by reformat_date
+  // and returns it packed.
+  //
+  // This is a constexpr function: in a constant expression an invalid date
+  // is a compile error, e.g.
+  //
+  //    constexpr uint32_t release = parse_date("March 1, 2023"); // ok
+  //    constexpr uint32_t typo = parse_date("Marhc 1, 2023");    // error
+  //
+  // Throws std::invalid_argument in the same cases as reformat_date when
+  // called at run time.
+  constexpr uint32_t parse_date(std::string_view input) {
+    return verify_tokens(tokenize_date(input));
+  }
+
+  // Parses a date in any of the four patterns accepted by reformat_date
+  // and returns it packed, without building any strings. Packed dates
+  // compare and sort chronologically as plain integers.
+  //
+  // Throws std::invalid_argument in the same cases as reformat_date.
+  uint32_t reformat_date_packed(std::string_view input) {
+    date_tokens tokens;
+    {
+      TRACE_SPAN("reformat_date/tokenize");
+      tokens = tokenize_date(input);
     }
 
-    if (parts[2] == "," && delimiter_count == 1) {
-      D = verify_format(parts[3], parts[0], parts[1]);
-    } else if ((parts[1] == "-" && parts[3] == "-") && delimiter_count == 2) {
-      D = verify_format(parts[0], parts[2], parts[4]);
-    } else if ((parts[1] == "/" && parts[3] == "/") && delimiter_count == 2) {
-      D = verify_format(parts[4], parts[0], parts[2]);
-    } else {
-      throw std::invalid_argument("Input does not fit pattern 1, 2, 3, or 4.");
+    TRACE_SPAN("reformat_date/verify_format");
+    return verify_tokens(tokens);
+  }
+
+  std::string reformat_date(std::string_view input) {
+    // ten characters fit in the small-string buffer, so this does not
+    // allocate
+    std::string D = "YYYY-MM-DD";
+    format_packed_date(reformat_date_packed(input), &D[0]);
+    return D;
+  }
+
+  // A date in YYYY-MM-DD form, held by value so it can be built at compile
+  // time.
+  struct iso_date {
+    char text[11] = {};
+
+    constexpr std::string_view view() const {
+      return std::string_view(text, 10);
     }
+  };
 
+  // Compile-time reformat_date: reformats input into a fixed buffer. As with
+  // parse_date, an invalid date is a compile error in a constant
+  // expression and throws std::invalid_argument at run time.
+  constexpr iso_date reformat_date_literal(std::string_view input) {
+    iso_date D;
+    format_packed_date(parse_date(input), D.text);
     return D;
   }
+
+  // Days from 1900-01-01 to the date in input; see packed_date_to_days.
+  //
+  // Throws std::invalid_argument in the same cases as reformat_date.
+  int32_t reformat_date_days(std::string_view input) {
+    return packed_date_to_days(reformat_date_packed(input));
+  }
+
+  // Reformats every date in inputs in parallel on pool.
+  //
+  // Throws std::invalid_argument, once every input has been attempted, if
+  // any input is not a valid date.
+  std::vector<std::string> reformat_date_batch(ThreadPool& pool, const std::vector<std::string>& inputs) {
+    std::vector<std::string> outputs(inputs.size());
+    parallel_for(pool, 0, inputs.size(), [&](size_t i) {
+      outputs[i] = reformat_date(inputs[i]);
+    });
+    return outputs;
+  }
+
+  // User-defined literals for dates that are normalized and validated at
+  // compile time when used in a constant expression:
+  //
+  //    using namespace algorithms::literals;
+  //    constexpr uint32_t launch = "jul 16, 1969"_date;      // packed
+  //    constexpr iso_date iso = "7/16/1969"_iso_date;        // "1969-07-16"
+  //
+  namespace literals {
+    constexpr uint32_t operator""_date(const char* input, size_t size) {
+      return parse_date(std::string_view(input, size));
+    }
+
+    constexpr iso_date operator""_iso_date(const char* input, size_t size) {
+      return reformat_date_literal(std::string_view(input, size));
+    }
+  }
 }
@@ -0,0 +1,477 @@
+///////////////////////////////////////////////////////////////////////////////
+// algorithms_server.cpp
+//
+// Long-running server that runs the algorithms in algorithms.hpp on
+// requests read from stdin or a Unix domain socket, so callers do not pay
+// process startup for every call.
+//
+// Protocol: one request per line, one response line per request, in
+// request order.
+//
+//    rle <PAYLOAD>           run_length_encode(PAYLOAD)
+//    date <PAYLOAD>          reformat_date(PAYLOAD)
+//    lfs <K> <PAYLOAD>       longest_frequent_substring(PAYLOAD, K)
+//    stats                   per-operation latency histogram summary
+//    quit                    close the connection
+//
+// A PAYLOAD of the form @PATH is read from the file PATH instead; lfs on
+// a file uses the out-of-core longest_frequent_substring_file.
+//
+// Responses are "ok <RESULT>" or "err <MESSAGE>". Backslash, newline and
+// carriage return in RESULT are written as \\, \n and \r.
+//
+// Requests are pipelined: complete lines that arrive together are
+// submitted in batches, one pool task per request, to a shared thread
+// pool, while a writer thread streams results back in order.
+//
+// @PATH reads any file the server can open, so the socket is created
+// accessible to its owner only (mode 0600).
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "algorithms.hpp"
+#include "timer.hpp"
+
+const size_t READ_BUFFER_SIZE{1 << 16},
+  MAX_BATCH_SIZE{64},      // requests collected before submitting
+  MAX_IN_FLIGHT{4096},     // requests read but not yet written back
+  WRITE_BUFFER_SIZE{1 << 16};
+
+enum class op_choice { rle, lfs, date, count };
+
+const char* const OP_NAMES[] = { "rle", "lfs", "date" };
+
+// Latency histogram with one bucket per power of two microseconds.
+class LatencyHistogram {
+private:
+  static const size_t BUCKETS = 40;
+  std::array<std::atomic<uint64_t>, BUCKETS> _counts{};
+  std::atomic<uint64_t> _max_us{0};
+
+public:
+  void record(double seconds) {
+    uint64_t us = static_cast<uint64_t>(seconds * 1e6);
+    size_t bucket = 0;
+    while (bucket + 1 < BUCKETS && (uint64_t(1) << bucket) <= us) {
+      bucket++;
+    }
+    _counts[bucket]++;
+    uint64_t max = _max_us;
+    while (us > max && !_max_us.compare_exchange_weak(max, us)) {
+    }
+  }
+
+  // "count=C p50_us=... p90_us=... p99_us=... max_us=..." where each
+  // percentile is the upper bound of the bucket it falls in.
+  std::string summary() const {
+    std::array<uint64_t, BUCKETS> counts;
+    uint64_t total = 0;
+    for (size_t b = 0; b < BUCKETS; b++) {
+      counts[b] = _counts[b];
+      total += counts[b];
+    }
+
+    std::stringstream ss;
+    ss << "count=" << total;
+    for (double p : { 0.50, 0.90, 0.99 }) {
+      uint64_t bound = 0, seen = 0;
+      for (size_t b = 0; b < BUCKETS && total > 0; b++) {
+        seen += counts[b];
+        if (seen >= p * total) {
+          bound = uint64_t(1) << b;
+          break;
+        }
+      }
+      ss << " p" << static_cast<int>(p * 100) << "_us=" << bound;
+    }
+    ss << " max_us=" << _max_us;
+    return ss.str();
+  }
+};
+
+std::array<LatencyHistogram, static_cast<size_t>(op_choice::count)> latencies;
+
+void print_usage() {
+  std::cout << "usage:" << std::endl << std::endl
+	    << "    algorithms_server [--threads <T>] [--socket <PATH>]" << std::endl << std::endl
+	    << "where" << std::endl << std::endl
+	    << "    --threads <T> runs requests on T worker threads (default: all cores)" << std::endl
+	    << "    --socket <PATH> listens on a Unix domain socket, mode 0600, instead of stdin" << std::endl
+	    << std::endl
+	    << "Example:" << std::endl
+	    << "    $ printf 'rle aaab\\ndate jan 5, 2022\\nstats\\n' | ./algorithms_server" << std::endl
+	    << std::endl;
+}
+
+// Escape backslash, newline and carriage return so result stays one line.
+void append_escaped(std::string& out, const std::string& result) {
+  for (char c : result) {
+    if (c == '\\') {
+      out += "\\\\";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else {
+      out += c;
+    }
+  }
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Splits off the text before the first space of rest; rest keeps what
+// follows that space.
+std::string_view next_word(std::string_view& rest) {
+  size_t space = rest.find(' ');
+  std::string_view word = rest.substr(0, space);
+  rest = (space == std::string_view::npos) ? std::string_view() : rest.substr(space + 1);
+  return word;
+}
+
+// Run one algorithm request and return its response line, without the
+// newline.
+std::string handle_request(std::string_view line) {
+  std::string_view rest = line;
+  std::string_view name = next_word(rest);
+
+  op_choice op;
+  if (name == "rle") {
+    op = op_choice::rle;
+  } else if (name == "lfs") {
+    op = op_choice::lfs;
+  } else if (name == "date") {
+    op = op_choice::date;
+  } else {
+    return "err unknown request \"" + std::string(name) + "\"";
+  }
+
+  Timer timer;
+  std::string response = "ok ";
+  try {
+    unsigned k = 0;
+    if (op == op_choice::lfs) {
+      std::string_view k_str = next_word(rest);
+      const unsigned max_k = std::numeric_limits<unsigned>::max();
+      bool valid = !k_str.empty();
+      for (char c : k_str) {
+        unsigned digit = c - '0';
+        if (c < '0' || c > '9' || k > (max_k - digit) / 10) {
+          valid = false;
+          break;
+        }
+        k = k * 10 + digit;
+      }
+      if (!valid) {
+        throw std::invalid_argument("K must be an integer from 0 to " + std::to_string(max_k));
+      }
+    }
+
+    bool from_file = !rest.empty() && rest[0] == '@';
+    std::string path(from_file ? rest.substr(1) : std::string_view());
+
+    std::string result;
+    if (op == op_choice::lfs && from_file) {
+      result = algorithms::longest_frequent_substring_file(path, k);
+    } else {
+      std::string payload = from_file ? read_file(path) : std::string(rest);
+      switch (op) {
+      case op_choice::rle:
+        result = algorithms::run_length_encode(payload);
+        break;
+      case op_choice::lfs:
+        result = payload.empty() ? "" : algorithms::longest_frequent_substring(payload, k);
+        break;
+      default:
+        result = algorithms::reformat_date(payload);
+        break;
+      }
+    }
+    append_escaped(response, result);
+  } catch (const std::exception& e) {
+    response = "err ";
+    append_escaped(response, e.what());
+  }
+  latencies[static_cast<size_t>(op)].record(timer.elapsed());
+  return response;
+}
+
+std::string stats_response() {
+  std::string response = "ok";
+  for (size_t op = 0; op < latencies.size(); op++) {
+    response += std::string(op ? "; " : " ") + OP_NAMES[op] + " " + latencies[op].summary();
+  }
+  return response;
+}
+
+bool write_all(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+// Responses of one connection, in request order. A null future marks a
+// stats request, which is answered when the writer reaches it so that it
+// counts every earlier request.
+class ResponseQueue {
+private:
+  std::deque<std::shared_future<std::string>> _responses;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  bool _closed = false;
+
+public:
+  // Blocks while MAX_IN_FLIGHT responses are already waiting.
+  void push(std::shared_future<std::string> response) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _responses.size() < MAX_IN_FLIGHT; });
+    _responses.push_back(std::move(response));
+    _changed.notify_all();
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _changed.notify_all();
+  }
+
+  // Writes responses to fd in order until the queue is closed and empty.
+  // Once a write fails, the rest are taken off the queue but neither
+  // waited for nor written.
+  void drain(int fd) {
+    std::string out;
+    bool writable = true;
+    while (true) {
+      std::shared_future<std::string> response;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_responses.empty() && !out.empty()) {
+          // nothing else is ready, so flush before sleeping
+          lock.unlock();
+          writable = write_all(fd, out);
+          out.clear();
+          lock.lock();
+        }
+        _changed.wait(lock, [this] { return _closed || !_responses.empty(); });
+        if (_responses.empty()) {
+          break;
+        }
+        response = std::move(_responses.front());
+        _responses.pop_front();
+        _changed.notify_all();
+      }
+      if (!writable) {
+        continue;
+      }
+      if (!out.empty() && response.valid() &&
+          response.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        // send what is ready instead of holding it behind a slow request
+        writable = write_all(fd, out);
+        out.clear();
+        if (!writable) {
+          continue;
+        }
+      }
+      out += response.valid() ? response.get() : stats_response();
+      out += '\n';
+      if (out.size() >= WRITE_BUFFER_SIZE) {
+        writable = write_all(fd, out);
+        out.clear();
+      }
+    }
+    if (writable) {
+      write_all(fd, out);
+    }
+  }
+};
+
+// Queue each request of a batch as its own pool task, so requests that
+// arrive together run in parallel; their responses still go out in order.
+void submit_batch(ThreadPool& pool, ResponseQueue& responses, std::vector<std::string>& batch) {
+  std::vector<std::shared_future<std::string>> futures;
+  for (std::string& line : batch) {
+    auto task = std::make_shared<std::packaged_task<std::string()>>(
+      [line = std::move(line)] { return handle_request(line); });
+    futures.push_back(task->get_future().share());
+    pool.submit([task] { (*task)(); });
+  }
+  for (std::shared_future<std::string>& f : futures) {
+    responses.push(std::move(f));
+  }
+  batch.clear();
+}
+
+// Serve one connection: read requests from in_fd and write responses to
+// out_fd until end of input or a quit request.
+void serve(ThreadPool& pool, int in_fd, int out_fd) {
+  ResponseQueue responses;
+  std::thread writer([&] { responses.drain(out_fd); });
+
+  std::vector<char> buffer(READ_BUFFER_SIZE);
+  std::string pending;  // incomplete last line
+  std::vector<std::string> batch;
+  bool quit = false;
+
+  while (!quit) {
+    ssize_t n = ::read(in_fd, buffer.data(), buffer.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    pending.append(buffer.data(), n);
+
+    // every complete line that arrived is batched before submitting
+    size_t start = 0, newline;
+    while (!quit && (newline = pending.find('\n', start)) != std::string::npos) {
+      std::string line = pending.substr(start, newline - start);
+      start = newline + 1;
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+
+      if (line == "quit") {
+        quit = true;
+      } else if (line == "stats") {
+        submit_batch(pool, responses, batch);
+        responses.push(std::shared_future<std::string>());
+      } else {
+        batch.push_back(std::move(line));
+        if (batch.size() == MAX_BATCH_SIZE) {
+          submit_batch(pool, responses, batch);
+        }
+      }
+    }
+    pending.erase(0, start);
+    submit_batch(pool, responses, batch);
+  }
+
+  if (!quit && !pending.empty()) {
+    batch.push_back(pending);
+    submit_batch(pool, responses, batch);
+  }
+
+  responses.close();
+  writer.join();
+}
+
+int main(int argc, char* argv[]) {
+
+  // Exit codes
+  const int SUCCESS = 0, USAGE_ERROR = 1, SOCKET_ERROR = 2;
+
+  size_t threads = 0;
+  std::string socket_path;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    if (arg == "--threads" && i + 1 < argc) {
+      try {
+        threads = std::stoul(argv[++i]);
+      } catch (const std::exception& e) {
+        std::cout << "error: <T> must be an integer" << std::endl << std::endl;
+        print_usage();
+        return USAGE_ERROR;
+      }
+    } else if (arg == "--socket" && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else {
+      print_usage();
+      return USAGE_ERROR;
+    }
+  }
+
+  // a client that disconnects early must fail only its own writes, not
+  // end the process
+  std::signal(SIGPIPE, SIG_IGN);
+
+  ThreadPool pool(threads);
+
+  if (socket_path.empty()) {
+    serve(pool, STDIN_FILENO, STDOUT_FILENO);
+    return SUCCESS;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "error: socket path is too long" << std::endl;
+    return USAGE_ERROR;
+  }
+  std::strcpy(address.sun_path, socket_path.c_str());
+
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(socket_path.c_str());
+  // owner-only from the moment it exists
+  mode_t old_mask = ::umask(0077);
+  int bound = (listener < 0) ? -1
+    : ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  ::umask(old_mask);
+  if (listener < 0 || bound < 0 ||
+      ::chmod(socket_path.c_str(), 0600) < 0 ||
+      ::listen(listener, SOMAXCONN) < 0) {
+    std::cerr << "error: " << socket_path << ": " << std::strerror(errno) << std::endl;
+    return SOCKET_ERROR;
+  }
+
+  // one thread per connection; the work itself runs on the shared pool
+  while (true) {
+    int connection = ::accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "error: accept: " << std::strerror(errno) << std::endl;
+      return SOCKET_ERROR;
+    }
+    std::thread([&pool, connection] {
+      serve(pool, connection, connection);
+      ::close(connection);
+    }).detach();
+  }
+}
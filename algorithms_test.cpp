@@ -5,10 +5,38 @@
 // Unit tests for the functionality declared in algorithms.hpp .
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <set>
+#include <thread>
+
 #include "gtest/gtest.h"
 
 #include "algorithms.hpp"
 
+// Count every heap allocation in the test binary, so tests can check that
+// a code path does not allocate.
+static std::atomic<size_t> allocation_count{0};
+
+void* operator new(std::size_t size) {
+  allocation_count++;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
 
 TEST(run_length_encode_trivial_cases, trivial_cases) {
   // empty string
@@ -103,6 +131,221 @@ TEST(run_length_encode_mixture, mixture) {
   }
 }
 
+TEST(run_length_encode_alphabets, alphabets) {
+  // the default alphabet is lowercase_alphabet
+  EXPECT_EQ("hel8o there", algorithms::run_length_encode<algorithms::lowercase_alphabet>("heloooooooo there"));
+  EXPECT_THROW(algorithms::run_length_encode<algorithms::lowercase_alphabet>("  A  "), std::invalid_argument);
+
+  // printable ASCII
+  EXPECT_EQ("3AB c", algorithms::run_length_encode<algorithms::printable_alphabet>("AAAB c"));
+  EXPECT_EQ("2!?~", algorithms::run_length_encode<algorithms::printable_alphabet>("!!?~"));
+  EXPECT_THROW(algorithms::run_length_encode<algorithms::printable_alphabet>("ab\tc"), std::invalid_argument);
+  EXPECT_THROW(algorithms::run_length_encode<algorithms::printable_alphabet>("ab\x80"), std::invalid_argument);
+
+  // digits and the escape character are escaped
+  EXPECT_EQ("A2\\1", algorithms::run_length_encode<algorithms::printable_alphabet>("A11"));
+  EXPECT_EQ("\\9\\0", algorithms::run_length_encode<algorithms::printable_alphabet>("90"));
+  EXPECT_EQ("3\\\\", algorithms::run_length_encode<algorithms::printable_alphabet>("\\\\\\"));
+
+  // raw bytes
+  EXPECT_EQ(std::string("4\0\n\xff", 4),
+            algorithms::run_length_encode<algorithms::byte_alphabet>(std::string("\0\0\0\0\n\xff", 6)));
+  EXPECT_EQ("12\\7x", algorithms::run_length_encode<algorithms::byte_alphabet>(std::string(12, '7') + "x"));
+  EXPECT_EQ("\xc3\xa9t\xc3\xa9", algorithms::run_length_encode<algorithms::byte_alphabet>("\xc3\xa9t\xc3\xa9"));
+}
+
+TEST(run_length_encode_strategies, strategies) {
+  // few runs, many runs, and a mixture, each long enough to be sampled
+  std::string uniform = "", long_runs = "", mixed = "";
+  for (int i = 0; i < 20000; i++) {
+    uniform += 'a' + (i * 7 + i / 26) % 26;
+    long_runs.append(1 + (i * 37) % 50, 'a' + i % 26);
+    mixed.append(1 + (i * 7) % 3, (i % 5 == 0) ? ' ' : 'a' + (i * 11) % 26);
+  }
+
+  const algorithms::rle_strategy strategies[] = {
+    algorithms::rle_strategy::scan, algorithms::rle_strategy::literal_copy, algorithms::rle_strategy::run_skip };
+
+  for (const std::string& s : { uniform, long_runs, mixed, std::string("heloooooooo there"), std::string("") }) {
+    std::string expected = algorithms::run_length_encode_with(s, algorithms::rle_strategy::scan);
+    EXPECT_EQ(expected, algorithms::run_length_encode(s));
+    for (algorithms::rle_strategy strategy : strategies) {
+      EXPECT_EQ(expected, algorithms::run_length_encode_with(s, strategy));
+    }
+  }
+
+  // escaped characters with every kernel
+  for (algorithms::rle_strategy strategy : strategies) {
+    EXPECT_EQ("A2\\1x3\\\\", algorithms::run_length_encode_with<algorithms::printable_alphabet>("A11x\\\\\\", strategy));
+    EXPECT_THROW(algorithms::run_length_encode_with(uniform + "A", strategy), std::invalid_argument);
+    EXPECT_THROW(algorithms::run_length_encode_with("A" + long_runs, strategy), std::invalid_argument);
+  }
+
+  // the sample picks a kernel for the data's profile
+  algorithms::rle_stats stats;
+  algorithms::run_length_encode(uniform, &stats);
+  EXPECT_EQ(algorithms::rle_strategy::literal_copy, stats.strategy);
+  EXPECT_LT(stats.run_density, 0.25);
+
+  algorithms::run_length_encode(long_runs, &stats);
+  EXPECT_EQ(algorithms::rle_strategy::run_skip, stats.strategy);
+  EXPECT_GE(stats.mean_run_length, 8);
+  EXPECT_EQ(algorithms::RLE_SAMPLE_WINDOWS * algorithms::RLE_SAMPLE_WINDOW_SIZE, stats.sampled);
+
+  algorithms::run_length_encode(mixed, &stats);
+  EXPECT_EQ(algorithms::rle_strategy::scan, stats.strategy);
+
+  // short inputs are not sampled
+  algorithms::run_length_encode(uniform.substr(0, algorithms::RLE_SAMPLE_MIN_SIZE - 1), &stats);
+  EXPECT_EQ(algorithms::rle_strategy::scan, stats.strategy);
+  EXPECT_EQ(0u, stats.sampled);
+}
+
+TEST(run_length_encode_in_place, in_place) {
+  for (const std::string& s : { std::string(""), std::string("a"), std::string("aa"), std::string("aaa"),
+                                std::string("heloooooooo there"), std::string("footloose and fancy free"),
+                                std::string("aa bb c d"), std::string(1000, 'z') + "y" + std::string(12, ' ') }) {
+    std::string buffer = s;
+    algorithms::run_length_encode_in_place(buffer);
+    EXPECT_EQ(algorithms::run_length_encode(s), buffer);
+  }
+
+  char raw[] = "gggghh";
+  EXPECT_EQ(4u, algorithms::run_length_encode_in_place(raw, 6));
+  EXPECT_EQ("4g2h", std::string(raw, 4));
+
+  // invalid input leaves the buffer untouched
+  std::string buffer = "aaaa  aA";
+  EXPECT_THROW(algorithms::run_length_encode_in_place(buffer), std::invalid_argument);
+  EXPECT_EQ("aaaa  aA", buffer);
+}
+
+TEST(run_length_encode_packed_format, packed_format) {
+  // round trips
+  for (const std::string& s : { std::string(""), std::string("a"), std::string("heloooooooo there"),
+                                std::string("footloose and fancy free"), std::string("\0\0\x01\xff\xff", 5) }) {
+    EXPECT_EQ(s, algorithms::run_length_decode_packed(algorithms::run_length_encode_packed(s)));
+    EXPECT_EQ(s, algorithms::run_length_decode_packed(algorithms::run_length_encode_packed(s, 2)));
+  }
+
+  // a run of 300 is stored as its byte and a two-byte varint
+  std::string packed = algorithms::run_length_encode_packed(std::string(300, 'z'));
+  EXPECT_EQ(std::string("RLE\x01\xac\x02\x01\x00z\xac\x02", 11), packed);
+  algorithms::rle_packed_header header = algorithms::read_rle_packed_header(packed);
+  EXPECT_EQ(300u, header.length);
+  EXPECT_EQ(1u, header.runs);
+  EXPECT_EQ(0u, header.block_runs);
+
+  // one index entry per block of runs
+  packed = algorithms::run_length_encode_packed("aabbbcdd", 2);
+  header = algorithms::read_rle_packed_header(packed);
+  EXPECT_EQ(8u, header.length);
+  EXPECT_EQ(4u, header.runs);
+  EXPECT_EQ(2u, header.block_runs);
+  EXPECT_EQ(header.index_pos + 32, header.payload_pos);
+  EXPECT_EQ(5u, algorithms::read_uint64_le(packed, header.index_pos + 16));
+  EXPECT_EQ(4u, algorithms::read_uint64_le(packed, header.index_pos + 24));
+
+  // decoding checks every index entry against the payload
+  std::string corrupt = packed;
+  corrupt[header.index_pos + 16] = 6;
+  EXPECT_THROW(algorithms::run_length_decode_packed(corrupt), std::invalid_argument);
+  EXPECT_THROW(algorithms::RleIndex::from_packed(corrupt), std::invalid_argument);
+
+  // conversion to and from the textual form
+  EXPECT_EQ("hel8o there",
+            algorithms::rle_packed_to_text(algorithms::rle_text_to_packed("hel8o there")));
+  EXPECT_EQ(algorithms::run_length_encode_packed("footloose and fancy free"),
+            algorithms::rle_text_to_packed(algorithms::run_length_encode("footloose and fancy free")));
+  EXPECT_EQ("A2\\1", algorithms::rle_packed_to_text<algorithms::printable_alphabet>(
+                        algorithms::run_length_encode_packed("A11")));
+  EXPECT_EQ("heloooooooo there", algorithms::run_length_decode("hel8o there"));
+
+  // malformed input
+  EXPECT_THROW(algorithms::rle_packed_to_text(algorithms::run_length_encode_packed("A11")), std::invalid_argument);
+  EXPECT_THROW(algorithms::run_length_decode_packed("RLE"), std::invalid_argument);
+  EXPECT_THROW(algorithms::run_length_decode_packed(packed.substr(0, packed.size() - 1)), std::invalid_argument);
+  EXPECT_THROW(algorithms::rle_text_to_packed("ab3"), std::invalid_argument);
+  EXPECT_THROW(algorithms::rle_text_to_packed("0a"), std::invalid_argument);
+
+  // header counts far beyond what the payload can hold
+  for (uint64_t runs : { uint64_t(1), uint64_t(1) << 62 }) {
+    std::string huge(algorithms::RLE_PACKED_MAGIC, sizeof(algorithms::RLE_PACKED_MAGIC));
+    algorithms::append_varint(huge, uint64_t(1) << 62);
+    algorithms::append_varint(huge, runs);
+    algorithms::append_varint(huge, 0);
+    huge += "a\x01";
+    EXPECT_THROW(algorithms::run_length_decode_packed(huge), std::invalid_argument);
+    EXPECT_THROW(algorithms::RleIndex::from_packed(huge), std::invalid_argument);
+  }
+
+  // a run longer than the header's length, and varints past 64 bits
+  std::string liar(algorithms::RLE_PACKED_MAGIC, sizeof(algorithms::RLE_PACKED_MAGIC));
+  liar += std::string("\x05\x01\x00a", 4);
+  algorithms::append_varint(liar, uint64_t(1) << 62);
+  EXPECT_THROW(algorithms::run_length_decode_packed(liar), std::invalid_argument);
+
+  size_t pos = 0;
+  EXPECT_EQ(UINT64_MAX, algorithms::read_varint(std::string(9, '\xff') + '\x01', pos));
+  pos = 0;
+  EXPECT_THROW(algorithms::read_varint(std::string(9, '\xff') + '\x7f', pos), std::invalid_argument);
+  pos = 0;
+  EXPECT_THROW(algorithms::read_varint(std::string(9, '\xff') + '\x02', pos), std::invalid_argument);
+}
+
+TEST(run_length_encode_random_access, random_access) {
+  // enough runs to span several sample blocks
+  std::string s = "";
+  for (int i = 0; i < 500; i++) {
+    s.append(1 + (i * 7) % 13, 'a' + (i % 26));
+  }
+
+  for (const algorithms::RleIndex& index :
+         { algorithms::RleIndex::from_text(algorithms::run_length_encode(s)),
+           algorithms::RleIndex::from_packed(algorithms::run_length_encode_packed(s, 16)) }) {
+    EXPECT_EQ(s.size(), index.size());
+    EXPECT_EQ(500u, index.runs());
+    for (size_t i = 0; i < s.size(); i++) {
+      EXPECT_EQ(s[i], index.at(i));
+    }
+    EXPECT_EQ(s, index.extract(0, s.size()));
+    EXPECT_EQ(s.substr(100, 900), index.extract(100, 1000));
+    EXPECT_EQ(s.substr(7, 1), index.extract(7, 8));
+    EXPECT_EQ("", index.extract(s.size(), s.size()));
+
+    EXPECT_THROW(index.at(s.size()), std::out_of_range);
+    EXPECT_THROW(index.extract(5, 4), std::out_of_range);
+    EXPECT_THROW(index.extract(0, s.size() + 1), std::out_of_range);
+  }
+
+  // in place on packed data, seeking through the block index or not
+  for (uint64_t block_runs : { 0, 1, 16, 1000 }) {
+    std::string packed = algorithms::run_length_encode_packed(s, block_runs);
+    for (size_t i = 0; i < s.size(); i += 7) {
+      EXPECT_EQ(s[i], algorithms::rle_packed_at(packed, i));
+    }
+    EXPECT_EQ(s, algorithms::rle_packed_extract(packed, 0, s.size()));
+    EXPECT_EQ(s.substr(100, 900), algorithms::rle_packed_extract(packed, 100, 1000));
+    EXPECT_EQ(s.substr(s.size() - 1), algorithms::rle_packed_extract(packed, s.size() - 1, s.size()));
+    EXPECT_EQ("", algorithms::rle_packed_extract(packed, 5, 5));
+    EXPECT_THROW(algorithms::rle_packed_at(packed, s.size()), std::out_of_range);
+    EXPECT_THROW(algorithms::rle_packed_extract(packed, 5, 4), std::out_of_range);
+  }
+
+  // empty input
+  algorithms::RleIndex empty = algorithms::RleIndex::from_text("");
+  EXPECT_EQ(0u, empty.size());
+  EXPECT_EQ("", empty.extract(0, 0));
+  EXPECT_THROW(empty.at(0), std::out_of_range);
+
+  // counts that do not fit in 64 bits, alone or summed
+  EXPECT_EQ(UINT64_MAX, algorithms::RleIndex::from_text("18446744073709551615a").size());
+  EXPECT_THROW(algorithms::RleIndex::from_text("18446744073709551616a"), std::invalid_argument);
+  EXPECT_THROW(algorithms::run_length_decode("99999999999999999999999a"), std::invalid_argument);
+  EXPECT_THROW(algorithms::RleIndex::from_text("18446744073709551615ab"), std::invalid_argument);
+  EXPECT_THROW(algorithms::rle_text_to_packed("18446744073709551615ab"), std::invalid_argument);
+}
+
 TEST(longest_frequent_substring_trivial_cases, trivial_cases) {
 
   // empty string
@@ -267,6 +510,67 @@ TEST(longest_frequent_substring_nontrivial_cases, nontrivial_cases) {
 	    algorithms::longest_frequent_substring(long_str, long_str.size() + 1));
 }
 
+TEST(longest_frequent_substring_file, file) {
+  char path[] = "/tmp/algorithms_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  const std::pair<std::string, unsigned> cases[] = {
+    { "", 2 }, { "a", 2 }, { "abc", 1 }, { "aabbc", 2 }, { "abcabcxyzab", 2 },
+    { "the quick brown fox jumps over the lazy dog", 2 },
+    { "the quick brown fox jumps over the lazy dog", 3 },
+    { "the quick brown fox jumps over the lazy dog", 5 },
+    { "the quick brown fox jumps over the lazy dog", 0 } };
+
+  for (const auto& c : cases) {
+    std::ofstream(path, std::ios::binary) << c.first;
+    std::string expected = c.first.empty() ? "" : algorithms::longest_frequent_substring(c.first, c.second);
+    EXPECT_EQ(expected, algorithms::longest_frequent_substring_file(path, c.second));
+    EXPECT_EQ(expected, algorithms::longest_frequent_substring_file(path, c.second, 3));
+  }
+
+  std::ofstream(path, std::ios::binary) << "xxaabbyyaabb";
+  algorithms::text_segment best = algorithms::longest_frequent_segment_file(path, 3, 1);
+  EXPECT_EQ(2u, best.offset);
+  EXPECT_EQ(4u, best.length);
+
+  unlink(path);
+  EXPECT_THROW(algorithms::longest_frequent_substring_file(path, 2), std::system_error);
+}
+
+TEST(longest_frequent_substring_top_k, top_k) {
+  const std::string text = "xxaabbyyaabbcaabbbbz";
+
+  // every maximal segment, in order
+  std::vector<std::pair<uint64_t, uint64_t>> segments;
+  for (algorithms::text_segment s : algorithms::FrequentSegments(text, 3)) {
+    segments.emplace_back(s.offset, s.length);
+  }
+  EXPECT_EQ((std::vector<std::pair<uint64_t, uint64_t>>{ { 2, 4 }, { 8, 4 }, { 13, 6 } }), segments);
+
+  // top 2, longest first, ties by offset
+  std::vector<algorithms::text_segment> best = algorithms::longest_frequent_segments(text, 3, 2);
+  ASSERT_EQ(2u, best.size());
+  EXPECT_EQ(13u, best[0].offset);
+  EXPECT_EQ(6u, best[0].length);
+  EXPECT_EQ(2u, best[1].offset);
+  EXPECT_EQ(4u, best[1].length);
+
+  // asking for more than exist returns them all
+  EXPECT_EQ(3u, algorithms::longest_frequent_segments(text, 3, 10).size());
+  EXPECT_EQ(0u, algorithms::longest_frequent_segments(text, 3, 0).size());
+  EXPECT_EQ(0u, algorithms::longest_frequent_segments("abc", 2, 5).size());
+
+  // the first result agrees with longest_frequent_substring
+  const std::string fox = "the quick brown fox jumps over the lazy dog";
+  for (unsigned k = 0; k < 6; k++) {
+    std::vector<algorithms::text_segment> top = algorithms::longest_frequent_segments(fox, k, 1);
+    ASSERT_EQ(1u, top.size());
+    EXPECT_EQ(algorithms::longest_frequent_substring(fox, k), fox.substr(top[0].offset, top[0].length));
+  }
+}
+
 TEST(reformat_date_pattern_1, pattern_1) {
   // return input unchanged
   EXPECT_EQ("2000-01-01", algorithms::reformat_date("2000-01-01"));
@@ -389,6 +693,41 @@ TEST(reformat_date_pattern_4, pattern_4) {
   EXPECT_EQ("2001-04-05", algorithms::reformat_date("APR 5, 2001"));
 }
 
+TEST(reformat_date_packed, packed) {
+  // same date in all four patterns
+  uint32_t packed = algorithms::reformat_date_packed("2022-2-3");
+  EXPECT_EQ((2022u << 9) | (2u << 5) | 3u, packed);
+  EXPECT_EQ(packed, algorithms::reformat_date_packed("02/03/2022"));
+  EXPECT_EQ(packed, algorithms::reformat_date_packed("february 3, 2022"));
+  EXPECT_EQ(packed, algorithms::reformat_date_packed("  Feb 3, 2022  "));
+  EXPECT_EQ(2022, algorithms::packed_year(packed));
+  EXPECT_EQ(2, algorithms::packed_month(packed));
+  EXPECT_EQ(3, algorithms::packed_day(packed));
+
+  // formatting writes exactly ten characters
+  char buffer[12] = "xxxxxxxxxxx";
+  algorithms::format_packed_date(packed, buffer);
+  EXPECT_EQ("2022-02-03x", std::string(buffer));
+
+  // packed dates sort chronologically
+  EXPECT_LT(algorithms::reformat_date_packed("1999-12-31"), algorithms::reformat_date_packed("2000-01-01"));
+  EXPECT_LT(algorithms::reformat_date_packed("2000-01-31"), algorithms::reformat_date_packed("2000-02-01"));
+  EXPECT_LT(algorithms::reformat_date_packed("2000-02-01"), algorithms::reformat_date_packed("2000-02-02"));
+
+  // days since 1900-01-01
+  EXPECT_EQ(0, algorithms::reformat_date_days("1900-01-01"));
+  EXPECT_EQ(59, algorithms::reformat_date_days("1900-03-01"));
+  EXPECT_EQ(25567, algorithms::reformat_date_days("jan 1, 1970"));
+  EXPECT_EQ(36583, algorithms::reformat_date_days("02/29/2000"));
+  EXPECT_EQ(73048, algorithms::reformat_date_days("december 31, 2099"));
+  EXPECT_EQ(algorithms::reformat_date_days("2021-03-03"), algorithms::reformat_date_days("2021-02-31"));
+
+  // same errors as reformat_date
+  EXPECT_THROW(algorithms::reformat_date_packed("2100-07-22"), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_packed("july 32, 2010"), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_days("abc"), std::invalid_argument);
+}
+
 TEST(reformat_invalid_format, invalid_format) {
 
   // not close to any pattern
@@ -497,3 +836,167 @@ TEST(reformat_invalid_field, invalid_field) {
   EXPECT_THROW(algorithms::reformat_date("07/100/2010"), std::invalid_argument);
   EXPECT_THROW(algorithms::reformat_date("july 100, 2010"), std::invalid_argument);
 }
+
+TEST(reformat_date_allocations, allocations) {
+  // build the inputs before counting
+  const std::string inputs[] = {
+    "2022-02-03", "   2022-2-3   ", "02/03/2022", "2/3/2022",
+    "February 3, 2022", "feb 3, 2022", "  SEPTEMBER 12, 2007  " };
+  const std::string expected[] = {
+    "2022-02-03", "2022-02-03", "2022-02-03", "2022-02-03",
+    "2022-02-03", "2022-02-03", "2007-09-12" };
+
+  size_t mismatches = 0;
+  size_t before = allocation_count;
+  for (int i = 0; i < 7; i++) {
+    std::string D = algorithms::reformat_date(inputs[i]);
+    if (D != expected[i]) {
+      mismatches++;
+    }
+  }
+  size_t after = allocation_count;
+
+  EXPECT_EQ(0u, mismatches);
+  EXPECT_EQ(before, after);
+}
+
+TEST(thread_pool_batches, batches) {
+  ThreadPool pool(4);
+
+  std::vector<std::string> texts = { "aaa", "heloooooooo there", "", "footloose and fancy free" };
+  std::vector<std::string> encoded = algorithms::run_length_encode_batch(pool, texts);
+  ASSERT_EQ(texts.size(), encoded.size());
+  for (size_t i = 0; i < texts.size(); i++) {
+    EXPECT_EQ(algorithms::run_length_encode(texts[i]), encoded[i]);
+  }
+  EXPECT_THROW(algorithms::run_length_encode_batch(pool, { "abc", "  A  ", "def" }), std::invalid_argument);
+
+  std::vector<std::string> dates = algorithms::reformat_date_batch(pool, { "2022-2-3", "02/03/2022", "feb 3, 2022" });
+  EXPECT_EQ(std::vector<std::string>(3, "2022-02-03"), dates);
+  EXPECT_THROW(algorithms::reformat_date_batch(pool, { "2022-2-3", "2100-01-01" }), std::invalid_argument);
+
+  std::vector<std::string> substrings = algorithms::longest_frequent_substring_batch(pool, { { "aabbc", 2 }, { "abc", 1 } });
+  EXPECT_EQ(std::vector<std::string>({ "aabb", "abc" }), substrings);
+
+  // reductions combine in index order
+  EXPECT_EQ(499500, parallel_reduce(pool, 0, 1000, 0, [](size_t i) { return (int) i; },
+                                    [](int a, int b) { return a + b; }));
+  std::string digits = parallel_reduce(pool, 0, 10, std::string(""),
+                                       [](size_t i) { return std::to_string(i); },
+                                       [](const std::string& a, const std::string& b) { return a + b; });
+  EXPECT_EQ("0123456789", digits);
+
+  // an outside caller only waits, so one worker means one thread
+  ThreadPool single(1);
+  std::set<std::thread::id> ran_on;
+  std::mutex ran_on_mutex;
+  parallel_for(single, 0, 64, [&](size_t) {
+    std::lock_guard<std::mutex> lock(ran_on_mutex);
+    ran_on.insert(std::this_thread::get_id());
+  });
+  EXPECT_EQ(1u, ran_on.size());
+  EXPECT_EQ(0u, ran_on.count(std::this_thread::get_id()));
+
+  // workers are pinned to CPUs the process may run on
+  ThreadPool pinned(2, true);
+#ifdef __linux__
+  EXPECT_EQ(2u, pinned.pinned());
+#endif
+  EXPECT_EQ(0u, single.pinned());
+
+  // a throwing call does not skip the rest of its chunk
+  std::atomic<int> attempted{0};
+  EXPECT_THROW(parallel_for(pool, 0, 100, [&](size_t i) {
+    attempted++;
+    if (i % 10 == 0) {
+      throw std::invalid_argument("index");
+    }
+  }, 50), std::invalid_argument);
+  EXPECT_EQ(100, attempted);
+
+  // nested parallel_for from inside pool tasks
+  std::atomic<int> count{0};
+  parallel_for(pool, 0, 8, [&](size_t) {
+    parallel_for(pool, 0, 8, [&](size_t) { count++; });
+  });
+  EXPECT_EQ(64, count);
+}
+
+// Compile-time versions of the run_length_encode and reformat_date cases
+// above. These are checked by the compiler; the test body only covers the
+// error cases, which would not compile as constant expressions.
+namespace constexpr_cases {
+  using algorithms::run_length_encode_literal;
+  using algorithms::reformat_date_literal;
+  using namespace algorithms::literals;
+
+  // run_length_encode trivial cases
+  static_assert(run_length_encode_literal("").view() == "");
+  static_assert(run_length_encode_literal("a").view() == "a");
+  static_assert(run_length_encode_literal(" a b c ").view() == " a b c ");
+  static_assert(run_length_encode_literal("abcdefghijklmnop").view() == "abcdefghijklmnop");
+  static_assert(run_length_encode_literal("the quick brown fox").view() == "the quick brown fox");
+
+  // run_length_encode just one run
+  static_assert(run_length_encode_literal("aaa").view() == "3a");
+  static_assert(run_length_encode_literal("zz").view() == "2z");
+  static_assert(run_length_encode_literal("zzzzzzzzz").view() == "9z");
+  static_assert(run_length_encode_literal("zzzzzzzzzz").view() == "10z");
+
+  // run_length_encode mixture
+  static_assert(run_length_encode_literal("heloooooooo there").view() == "hel8o there");
+  static_assert(run_length_encode_literal("footloose and fancy free").view() == "f2otl2ose and fancy fr2e");
+  static_assert(run_length_encode_literal("abcddd").view() == "abc3d");
+  static_assert(run_length_encode_literal("gggghh").view() == "4g2h");
+  static_assert(run_length_encode_literal("aa b cc d").view() == "2a b 2c d");
+  static_assert(run_length_encode_literal(" ii jj kk ll mm nn oo ").view() == " 2i 2j 2k 2l 2m 2n 2o ");
+
+  // run_length_encode with escapes
+  static_assert(run_length_encode_literal<algorithms::printable_alphabet>("A11").view() == "A2\\1");
+
+  // reformat_date pattern 1
+  static_assert(reformat_date_literal("2000-01-01").view() == "2000-01-01");
+  static_assert(reformat_date_literal("1900-02-02").view() == "1900-02-02");
+  static_assert(reformat_date_literal("2099-02-02").view() == "2099-02-02");
+  static_assert(reformat_date_literal("2022-02-31").view() == "2022-02-31");
+  static_assert(reformat_date_literal("2022-2-3").view() == "2022-02-03");
+  static_assert(reformat_date_literal("     2022-02-03").view() == "2022-02-03");
+  static_assert(reformat_date_literal("2022-02-03     ").view() == "2022-02-03");
+
+  // reformat_date pattern 2
+  static_assert(reformat_date_literal("01/01/2000").view() == "2000-01-01");
+  static_assert(reformat_date_literal("12/02/2022").view() == "2022-12-02");
+  static_assert(reformat_date_literal("2/3/2022").view() == "2022-02-03");
+
+  // reformat_date pattern 3
+  static_assert(reformat_date_literal("january 1, 2000").view() == "2000-01-01");
+  static_assert(reformat_date_literal("december 2, 2022").view() == "2022-12-02");
+  static_assert(reformat_date_literal("SePtEmBeR 12, 2007").view() == "2007-09-12");
+
+  // reformat_date pattern 4
+  static_assert(reformat_date_literal("jan 1, 2000").view() == "2000-01-01");
+  static_assert(reformat_date_literal("dec 2, 2022").view() == "2022-12-02");
+  static_assert(reformat_date_literal("aPr 5, 2001").view() == "2001-04-05");
+
+  // literals
+  static_assert("feb 3, 2022"_date == ((2022u << 9) | (2u << 5) | 3u));
+  static_assert("02/03/2022"_iso_date.view() == "2022-02-03");
+  static_assert("1999-12-31"_date < "jan 1, 2000"_date);
+}
+
+TEST(constexpr_literals, invalid_literals) {
+  // at run time the constexpr cores throw like the ordinary functions
+  EXPECT_THROW(algorithms::run_length_encode_literal("  A  "), std::invalid_argument);
+  EXPECT_THROW(algorithms::run_length_encode_literal("  9  "), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_literal("2001-05-10abc"), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_literal("2000-01-01-01"), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_literal("juneuary 28, 2021"), std::invalid_argument);
+  EXPECT_THROW(algorithms::reformat_date_literal("07/22/1899"), std::invalid_argument);
+  EXPECT_THROW(algorithms::parse_date("july 32, 2010"), std::invalid_argument);
+
+  // and agree with them on valid input
+  EXPECT_EQ(algorithms::run_length_encode("footloose and fancy free"),
+            algorithms::run_length_encode_literal("footloose and fancy free").view());
+  EXPECT_EQ(algorithms::reformat_date("  Feb 3, 2022  "),
+            algorithms::reformat_date_literal("  Feb 3, 2022  ").view());
+}
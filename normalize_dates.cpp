@@ -0,0 +1,686 @@
+///////////////////////////////////////////////////////////////////////////////
+// normalize_dates.cpp
+//
+// Rewrites one date column of a large delimited file into YYYY-MM-DD form
+// with reformat_date, streaming from an input file to an output file.
+//
+// The work is pipelined in three stages:
+//
+// 1. A reader thread reads the input in CHUNK_SIZE blocks, keeping up to
+//    READ_AHEAD reads in flight with io_uring, splits the data at line
+//    boundaries and hands each run of whole lines to the thread pool.
+// 2. Pool workers normalize the date field of every line of a run.
+//    Lines whose field is missing or is not a valid date go to the reject
+//    output unchanged instead.
+// 3. The main thread takes finished runs in input order and writes them
+//    behind, keeping up to WRITE_BEHIND writes in flight with io_uring.
+//
+// If io_uring is unavailable, or --no-uring is given, the reader and
+// writer fall back to plain blocking pread and write calls.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "algorithms.hpp"
+#include "timer.hpp"
+
+const size_t CHUNK_SIZE{4 << 20};   // bytes per read
+const unsigned READ_AHEAD{4},       // reads in flight
+  WRITE_BEHIND{8};                  // writes in flight
+
+void print_usage() {
+  std::cout << "usage:" << std::endl << std::endl
+	    << "    normalize_dates <INPUT> <OUTPUT> <REJECTS> [--column <C>] [--delimiter <D>]"
+	    << std::endl
+	    << "                    [--threads <T>] [--no-uring]" << std::endl << std::endl
+	    << "where" << std::endl << std::endl
+	    << "    <INPUT> is a file of delimited lines" << std::endl
+	    << "    <OUTPUT> receives the lines with column <C> reformatted as YYYY-MM-DD" << std::endl
+	    << "    <REJECTS> receives, unchanged, lines whose column <C> is missing or invalid"
+	    << std::endl
+	    << "    --column <C> is the 0-based date column (default: 0)" << std::endl
+	    << "    --delimiter <D> is the one-character field delimiter (default: tab)" << std::endl
+	    << "    --threads <T> normalizes on T worker threads (default: all cores)" << std::endl
+	    << "    --no-uring uses blocking reads and writes instead of io_uring" << std::endl
+	    << std::endl
+	    << "Example:" << std::endl
+	    << "    $ ./normalize_dates events.tsv events_iso.tsv rejects.tsv --column 2" << std::endl
+	    << std::endl;
+}
+
+// Minimal io_uring instance for reads and writes at file offsets, owned by
+// a single reader or writer.
+class IoUring {
+private:
+  int _fd = -1;
+  unsigned _entries = 0;
+  void* _sq_ring = MAP_FAILED;
+  void* _cq_ring = MAP_FAILED;
+  size_t _sq_ring_size = 0, _cq_ring_size = 0, _sqes_size = 0;
+  unsigned *_sq_head, *_sq_tail, *_sq_mask, *_sq_array;
+  unsigned *_cq_head, *_cq_tail, *_cq_mask;
+  io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  io_uring_cqe* _cqes;
+  bool _supports_read_write = false;
+
+  template <typename T>
+  static T* at(void* base, unsigned offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, _fd, to_submit, min_complete, flags, nullptr, 0);
+  }
+
+  // True if the kernel supports IORING_OP_READ and IORING_OP_WRITE. Kernels
+  // before 5.6 have neither the opcodes nor IORING_REGISTER_PROBE, so
+  // there the probe itself fails.
+  bool probe_read_write() {
+    const unsigned OPS = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, OPS) < 0) {
+      return false;
+    }
+    for (unsigned op : { IORING_OP_READ, IORING_OP_WRITE }) {
+      if (op > probe->last_op || op >= probe->ops_len ||
+          (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  // Sets up a ring with room for entries requests. ok() is false if the
+  // kernel does not support io_uring, refuses it, or does not support
+  // reads and writes on it.
+  explicit IoUring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    _fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (_fd < 0) {
+      return;
+    }
+    _entries = params.sq_entries;
+
+    _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    }
+    _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+      return;
+    }
+    _cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? _sq_ring
+      : mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+    if (_cq_ring == MAP_FAILED) {
+      return;
+    }
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+					    MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES));
+
+    _sq_head = at<unsigned>(_sq_ring, params.sq_off.head);
+    _sq_tail = at<unsigned>(_sq_ring, params.sq_off.tail);
+    _sq_mask = at<unsigned>(_sq_ring, params.sq_off.ring_mask);
+    _sq_array = at<unsigned>(_sq_ring, params.sq_off.array);
+    _cq_head = at<unsigned>(_cq_ring, params.cq_off.head);
+    _cq_tail = at<unsigned>(_cq_ring, params.cq_off.tail);
+    _cq_mask = at<unsigned>(_cq_ring, params.cq_off.ring_mask);
+    _cqes = at<io_uring_cqe>(_cq_ring, params.cq_off.cqes);
+    _supports_read_write = probe_read_write();
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  ~IoUring() {
+    if (_sqes != MAP_FAILED) {
+      munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+      munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring != MAP_FAILED) {
+      munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  bool ok() const {
+    return _fd >= 0 && _sqes != MAP_FAILED && _supports_read_write;
+  }
+
+  // Queue and submit one read (IORING_OP_READ) or write (IORING_OP_WRITE)
+  // of size bytes at offset. The caller keeps at most the ring's entries
+  // requests in flight.
+  void submit(unsigned char opcode, int fd, void* buffer, unsigned size,
+	      uint64_t offset, uint64_t user_data) {
+    unsigned tail = *_sq_tail;
+    unsigned index = tail & *_sq_mask;
+    io_uring_sqe& sqe = _sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+    sqe.len = size;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (enter(1, 0, 0) < 0) {
+      if (errno != EINTR && errno != EAGAIN) {
+	throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+      }
+    }
+  }
+
+  // Wait for the next completion and return it.
+  io_uring_cqe wait() {
+    while (true) {
+      unsigned head = *_cq_head;
+      if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+	io_uring_cqe cqe = _cqes[head & *_cq_mask];
+	__atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+	return cqe;
+      }
+      if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+	throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+      }
+    }
+  }
+};
+
+// Normalized lines and rejected lines of one run of input lines.
+struct chunk_result {
+  std::string output;
+  std::string rejects;
+  size_t lines = 0;
+  size_t rejected = 0;
+};
+
+// Normalize the date field of every line in lines, which holds whole
+// lines, each ending in '\n' except possibly the last. Lines keep their
+// endings, so an unterminated last line stays unterminated.
+chunk_result normalize_lines(std::string_view lines, size_t column, char delimiter) {
+  chunk_result result;
+  result.output.reserve(lines.size() + lines.size() / 8);
+
+  size_t start = 0;
+  while (start < lines.size()) {
+    size_t newline = lines.find('\n', start);
+    bool terminated = (newline != std::string_view::npos);
+    size_t end = terminated ? newline : lines.size();
+    std::string_view line = lines.substr(start, end - start);
+    start = end + 1;
+    result.lines++;
+
+    // keep a CR of CRLF line endings out of the last field
+    std::string_view body = line;
+    if (!body.empty() && body.back() == '\r') {
+      body.remove_suffix(1);
+    }
+
+    size_t field_start = 0;
+    for (size_t c = 0; c < column && field_start != std::string_view::npos; c++) {
+      size_t next = body.find(delimiter, field_start);
+      field_start = (next == std::string_view::npos) ? next : next + 1;
+    }
+
+    bool valid = (field_start != std::string_view::npos);
+    uint32_t packed = 0;
+    size_t field_end = 0;
+    if (valid) {
+      field_end = std::min(body.find(delimiter, field_start), body.size());
+      try {
+	packed = algorithms::parse_date(body.substr(field_start, field_end - field_start));
+      } catch (const std::invalid_argument& e) {
+	valid = false;
+      }
+    }
+
+    if (!valid) {
+      result.rejects.append(line);
+      if (terminated) {
+	result.rejects += '\n';
+      }
+      result.rejected++;
+      continue;
+    }
+
+    char iso[10];
+    algorithms::format_packed_date(packed, iso);
+    result.output.append(line.substr(0, field_start));
+    result.output.append(iso, sizeof(iso));
+    result.output.append(line.substr(field_end));
+    if (terminated) {
+      result.output += '\n';
+    }
+  }
+  return result;
+}
+
+// Reads size bytes at offset, retrying short reads. Returns the number of
+// bytes read, which is less than size only at end of file.
+size_t read_at(int fd, char* buffer, size_t size, uint64_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, buffer + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw std::system_error(errno, std::generic_category(), "read");
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+void write_at(int fd, const char* buffer, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t n = pwrite(fd, buffer, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "write");
+    }
+    buffer += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+// Futures of normalized runs, in input order, bounded so the reader
+// cannot get arbitrarily far ahead of the writer.
+class ChunkQueue {
+private:
+  std::deque<std::future<chunk_result>> _chunks;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  size_t _capacity;
+  bool _closed = false;
+  bool _cancelled = false;
+
+public:
+  explicit ChunkQueue(size_t capacity) : _capacity(capacity) { }
+
+  // Returns false, without queueing chunk, once the queue is cancelled.
+  bool push(std::future<chunk_result> chunk) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _cancelled || _chunks.size() < _capacity; });
+    if (_cancelled) {
+      return false;
+    }
+    _chunks.push_back(std::move(chunk));
+    _changed.notify_all();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _changed.notify_all();
+  }
+
+  // Drop every queued chunk and refuse new ones, so a reader blocked in
+  // push returns after the writer has failed.
+  void cancel() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cancelled = true;
+    _chunks.clear();
+    _changed.notify_all();
+  }
+
+  // Returns false once the queue is closed and empty, or cancelled.
+  bool pop(std::future<chunk_result>& chunk) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait(lock, [this] { return _closed || _cancelled || !_chunks.empty(); });
+    if (_cancelled || _chunks.empty()) {
+      return false;
+    }
+    chunk = std::move(_chunks.front());
+    _chunks.pop_front();
+    _changed.notify_all();
+    return true;
+  }
+};
+
+// Calls deliver(data, size) for consecutive CHUNK_SIZE blocks of the file,
+// in order, keeping READ_AHEAD reads in flight on ring if it is not null.
+// Stops early when deliver returns false.
+template <typename Function>
+void read_blocks(int fd, uint64_t file_size, IoUring* ring, Function deliver) {
+  size_t blocks = (file_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+  if (ring == nullptr) {
+    std::vector<char> buffer(CHUNK_SIZE);
+    for (size_t b = 0; b < blocks; b++) {
+      uint64_t offset = b * CHUNK_SIZE;
+      size_t size = read_at(fd, buffer.data(), std::min<uint64_t>(CHUNK_SIZE, file_size - offset), offset);
+      if (!deliver(buffer.data(), size)) {
+	return;
+      }
+    }
+    return;
+  }
+
+  std::map<size_t, std::unique_ptr<std::vector<char>>> in_flight;
+  std::map<size_t, size_t> completed; // block -> bytes read by the ring
+  size_t next_submit = 0, next_deliver = 0;
+  size_t in_ring = 0; // reads submitted but not yet reaped
+
+  // on an early return or an error, reads still in the ring must land
+  // before their buffers are freed
+  auto settle = [&] {
+    for (; in_ring > 0; in_ring--) {
+      try {
+	ring->wait();
+      } catch (const std::system_error& e) {
+	return;
+      }
+    }
+  };
+
+  try {
+    while (next_deliver < blocks) {
+      while (next_submit < blocks && next_submit < next_deliver + READ_AHEAD) {
+	uint64_t offset = next_submit * CHUNK_SIZE;
+	size_t size = std::min<uint64_t>(CHUNK_SIZE, file_size - offset);
+	std::unique_ptr<std::vector<char>>& buffer = in_flight[next_submit];
+	buffer.reset(new std::vector<char>(size));
+	ring->submit(IORING_OP_READ, fd, buffer->data(), size, offset, next_submit);
+	in_ring++;
+	next_submit++;
+      }
+
+      while (completed.count(next_deliver) == 0) {
+	io_uring_cqe cqe = ring->wait();
+	in_ring--;
+	if (cqe.res < 0) {
+	  throw std::system_error(-cqe.res, std::generic_category(), "read");
+	}
+	completed[cqe.user_data] = cqe.res;
+      }
+
+      std::vector<char>& buffer = *in_flight[next_deliver];
+      size_t got = completed[next_deliver];
+      if (got < buffer.size()) {
+	// finish a short read synchronously
+	got += read_at(fd, buffer.data() + got, buffer.size() - got, next_deliver * CHUNK_SIZE + got);
+      }
+      if (!deliver(buffer.data(), got)) {
+	break;
+      }
+      in_flight.erase(next_deliver);
+      completed.erase(next_deliver);
+      next_deliver++;
+    }
+  } catch (...) {
+    settle();
+    throw;
+  }
+  settle();
+}
+
+// Writes data to fd at offset, write-behind on ring if it is not null.
+// Buffers stay alive in pending until their write completes.
+class BlockWriter {
+private:
+  int _fd;
+  IoUring* _ring;
+  uint64_t _offset = 0;
+  uint64_t _next_id = 0;
+  std::map<uint64_t, std::pair<uint64_t, std::string>> _pending; // id -> (offset, data)
+
+  // Wait for one write to complete and release its buffer, throwing if
+  // the write failed.
+  void reap_one() {
+    io_uring_cqe cqe = _ring->wait();
+    auto found = _pending.find(cqe.user_data);
+    std::pair<uint64_t, std::string> write = std::move(found->second);
+    _pending.erase(found);
+    if (cqe.res < 0) {
+      throw std::system_error(-cqe.res, std::generic_category(), "write");
+    }
+    if (static_cast<size_t>(cqe.res) < write.second.size()) {
+      // finish a short write synchronously
+      write_at(_fd, write.second.data() + cqe.res, write.second.size() - cqe.res, write.first + cqe.res);
+    }
+  }
+
+public:
+  BlockWriter(int fd, IoUring* ring) : _fd(fd), _ring(ring) { }
+
+  BlockWriter(const BlockWriter&) = delete;
+  BlockWriter& operator=(const BlockWriter&) = delete;
+
+  // Writes still in flight when an error unwinds the writer must land
+  // before their buffers are freed; their own errors are dropped.
+  ~BlockWriter() {
+    for (size_t left = _pending.size(); _ring != nullptr && left > 0; left--) {
+      try {
+	reap_one();
+      } catch (const std::system_error& e) {
+      }
+    }
+  }
+
+  void write(std::string data) {
+    if (data.empty()) {
+      return;
+    }
+    if (_ring == nullptr) {
+      write_at(_fd, data.data(), data.size(), _offset);
+      _offset += data.size();
+      return;
+    }
+    while (_pending.size() >= WRITE_BEHIND) {
+      reap_one();
+    }
+    // io_uring transfers at most 2^31 bytes per request
+    uint64_t id = _next_id++;
+    std::pair<uint64_t, std::string>& write = _pending[id];
+    write.first = _offset;
+    write.second = std::move(data);
+    _offset += write.second.size();
+    _ring->submit(IORING_OP_WRITE, _fd, &write.second[0],
+		  std::min<size_t>(write.second.size(), 1u << 31), write.first, id);
+  }
+
+  void finish() {
+    while (_ring != nullptr && !_pending.empty()) {
+      reap_one();
+    }
+  }
+};
+
+int main(int argc, char* argv[]) {
+
+  // Exit codes
+  const int SUCCESS = 0, USAGE_ERROR = 1, IO_ERROR = 2;
+
+  std::vector<std::string> positional;
+  size_t column = 0, threads = 0;
+  char delimiter = '\t';
+  bool use_uring = true;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    try {
+      if (arg == "--column" && i + 1 < argc) {
+	column = std::stoul(argv[++i]);
+      } else if (arg == "--threads" && i + 1 < argc) {
+	threads = std::stoul(argv[++i]);
+      } else if (arg == "--delimiter" && i + 1 < argc && std::strlen(argv[i + 1]) == 1) {
+	delimiter = argv[++i][0];
+      } else if (arg == "--no-uring") {
+	use_uring = false;
+      } else if (arg.rfind("--", 0) == 0) {
+	throw std::invalid_argument(arg);
+      } else {
+	positional.push_back(arg);
+      }
+    } catch (const std::exception& e) {
+      std::cout << "error: bad option \"" << arg << "\"" << std::endl << std::endl;
+      print_usage();
+      return USAGE_ERROR;
+    }
+  }
+
+  if (positional.size() != 3) {
+    print_usage();
+    return USAGE_ERROR;
+  }
+
+  int in_fd = open(positional[0].c_str(), O_RDONLY);
+  int out_fd = open(positional[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int reject_fd = open(positional[2].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  struct stat in_stat;
+  if (in_fd < 0 || out_fd < 0 || reject_fd < 0 || fstat(in_fd, &in_stat) < 0) {
+    std::cout << "error: " << std::strerror(errno) << std::endl;
+    return IO_ERROR;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  // one ring per stream, since a ring's completions are reaped by the
+  // one reader or writer that owns it
+  std::unique_ptr<IoUring> read_ring, output_ring, reject_ring;
+  if (use_uring) {
+    read_ring.reset(new IoUring(READ_AHEAD));
+    output_ring.reset(new IoUring(WRITE_BEHIND));
+    reject_ring.reset(new IoUring(WRITE_BEHIND));
+    if (!read_ring->ok() || !output_ring->ok() || !reject_ring->ok()) {
+      read_ring.reset();
+      output_ring.reset();
+      reject_ring.reset();
+    }
+  }
+
+  ThreadPool pool(threads);
+  ChunkQueue chunks(2 * pool.size() + READ_AHEAD);
+
+  Timer timer;
+
+  // stage 1: read and split at line boundaries
+  std::exception_ptr read_error;
+  std::thread reader([&] {
+    try {
+      std::string carry;
+      // false once the writer has failed and cancelled the queue
+      auto submit = [&](std::string lines) {
+	auto shared_lines = std::make_shared<std::string>(std::move(lines));
+	auto task = std::make_shared<std::packaged_task<chunk_result()>>([shared_lines, column, delimiter] {
+	  return normalize_lines(*shared_lines, column, delimiter);
+	});
+	if (!chunks.push(task->get_future())) {
+	  return false;
+	}
+	pool.submit([task] { (*task)(); });
+	return true;
+      };
+
+      read_blocks(in_fd, in_stat.st_size, read_ring.get(), [&](const char* data, size_t size) {
+	std::string_view block(data, size);
+	size_t last_newline = block.rfind('\n');
+	if (last_newline == std::string_view::npos) {
+	  carry.append(block);
+	  return true;
+	}
+	std::string lines = std::move(carry);
+	lines.append(block.substr(0, last_newline + 1));
+	carry.assign(block.substr(last_newline + 1));
+	return submit(std::move(lines));
+      });
+
+      if (!carry.empty()) {
+	submit(std::move(carry));
+      }
+    } catch (...) {
+      read_error = std::current_exception();
+    }
+    chunks.close();
+  });
+
+  // stage 3: write in order, behind the normalization
+  size_t lines = 0, rejected = 0;
+  int status = SUCCESS;
+  try {
+    BlockWriter output(out_fd, output_ring.get()), rejects(reject_fd, reject_ring.get());
+    std::future<chunk_result> chunk;
+    while (chunks.pop(chunk)) {
+      chunk_result result = chunk.get();
+      lines += result.lines;
+      rejected += result.rejected;
+      output.write(std::move(result.output));
+      rejects.write(std::move(result.rejects));
+    }
+    output.finish();
+    rejects.finish();
+  } catch (const std::exception& e) {
+    // e.g. an I/O error, or bad_alloc from a normalization task; the
+    // reader must still be stopped and joined
+    std::cout << "error: " << e.what() << std::endl;
+    status = IO_ERROR;
+    chunks.cancel();
+  }
+  reader.join();
+
+  if (read_error) {
+    try {
+      std::rethrow_exception(read_error);
+    } catch (const std::exception& e) {
+      std::cout << "error: " << e.what() << std::endl;
+      status = IO_ERROR;
+    }
+  }
+
+  double elapsed = timer.elapsed();
+  close(in_fd);
+  close(out_fd);
+  close(reject_fd);
+
+  std::cout << "io = " << (read_ring ? "io_uring" : "read/write") << std::endl
+	    << "threads = " << pool.size() << std::endl
+	    << "lines = " << lines << std::endl
+	    << "rejected = " << rejected << std::endl
+	    << "elapsed time=" << elapsed << " seconds" << std::endl
+	    << "throughput=" << in_stat.st_size / elapsed / 1e6 << " MB/s" << std::endl;
+
+  return status;
+}
@@ -0,0 +1,320 @@
+///////////////////////////////////////////////////////////////////////////////
+// thread_pool.hpp
+//
+// Work-stealing thread pool, plus parallel_for and parallel_reduce helpers
+// built on it.
+//
+// Each worker owns a task deque. A worker pops from the back of its own
+// deque and, when that is empty, steals from the front of the others.
+// Workers that wait for parallel work to finish run queued tasks in the
+// meantime, so the helpers may be nested inside pool tasks. Other threads
+// only wait, so a pool of T workers runs parallel work on exactly T
+// threads.
+//
+// How to use:
+//
+//    ThreadPool pool;       // one worker per hardware thread
+//    ThreadPool pool(4);    // four workers
+//    parallel_for(pool, 0, n, [&](size_t i) { out[i] = f(in[i]); });
+//    long sum = parallel_reduce(pool, 0, n, 0L,
+//                               [&](size_t i) { return (long) v[i]; },
+//                               [](long a, long b) { return a + b; });
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class ThreadPool {
+private:
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<size_t> _pending{0};     // tasks queued but not yet started
+  std::atomic<size_t> _next_queue{0};  // round-robin target for outside submits
+  size_t _pinned = 0;                  // workers bound to a CPU
+  std::mutex _sleep_mutex;
+  std::condition_variable _wake;
+  bool _stop = false;
+
+  // Pool and deque index of the calling worker thread; the pool is null
+  // on threads that are not workers.
+  static const ThreadPool*& current_pool() {
+    static thread_local const ThreadPool* pool = nullptr;
+    return pool;
+  }
+
+  static size_t& current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+
+  bool pop(size_t queue, bool from_back, std::function<void()>& task) {
+    worker_queue& q = *_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) {
+      return false;
+    }
+    if (from_back) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    _pending--;
+    return true;
+  }
+
+  void worker_loop(size_t index) {
+    current_pool() = this;
+    current_index() = index;
+    while (true) {
+      if (try_run_one()) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      _wake.wait(lock, [this] { return _stop || _pending > 0; });
+      if (_stop && _pending == 0) {
+        return;
+      }
+    }
+  }
+
+  // CPUs the process may run on, which under taskset or a cgroup CPU
+  // limit is fewer than the machine has.
+  static std::vector<int> allowed_cpus() {
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus)) {
+          allowed.push_back(cpu);
+        }
+      }
+    }
+#endif
+    return allowed;
+  }
+
+  // Binds worker index to one of cpus, round-robin. Returns false if that
+  // failed or is not supported.
+  bool pin(size_t index, const std::vector<int>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) {
+      return false;
+    }
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(cpus[index % cpus.size()], &cpu);
+    return pthread_setaffinity_np(_threads[index].native_handle(), sizeof(cpu), &cpu) == 0;
+#else
+    return false;
+#endif
+  }
+
+public:
+
+  // Start a pool with the given number of workers; 0 means one per
+  // hardware thread. If pin_threads is true, worker i is bound to the i-th
+  // CPU the process may run on (modulo their number) where the platform
+  // supports it; pinned() tells how many workers that succeeded for.
+  explicit ThreadPool(size_t threads = 0, bool pin_threads = false) {
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+      _queues.emplace_back(new worker_queue);
+    }
+    std::vector<int> cpus = pin_threads ? allowed_cpus() : std::vector<int>();
+    for (size_t i = 0; i < threads; i++) {
+      _threads.emplace_back([this, i] { worker_loop(i); });
+      if (pin_threads && pin(i, cpus)) {
+        _pinned++;
+      }
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs every queued task, then joins the workers.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& t : _threads) {
+      t.join();
+    }
+  }
+
+  // Number of worker threads.
+  size_t size() const {
+    return _threads.size();
+  }
+
+  // Number of workers bound to a CPU; less than size() if pinning was
+  // asked for but failed for some workers.
+  size_t pinned() const {
+    return _pinned;
+  }
+
+  // True if the calling thread is one of this pool's workers.
+  bool is_worker() const {
+    return current_pool() == this;
+  }
+
+  // Queue a task. Tasks submitted from a worker go to that worker's own
+  // deque; others are spread round-robin.
+  void submit(std::function<void()> task) {
+    size_t queue = (current_pool() == this) ? current_index()
+                                            : _next_queue++ % _queues.size();
+    // count the task first so _pending never drops below zero when a
+    // worker pops it before this thread returns from the push
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _pending++;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_queues[queue]->mutex);
+      _queues[queue]->tasks.push_back(std::move(task));
+    }
+    _wake.notify_one();
+  }
+
+  // Run one queued task on the calling thread, preferring the caller's own
+  // deque. Returns false if every deque was empty.
+  bool try_run_one() {
+    std::function<void()> task;
+    size_t home = (current_pool() == this) ? current_index() : 0;
+    bool found = (current_pool() == this) && pop(home, true, task);
+    for (size_t k = 0; !found && k < _queues.size(); k++) {
+      found = pop((home + k) % _queues.size(), false, task);
+    }
+    if (found) {
+      task();
+    }
+    return found;
+  }
+};
+
+// Calls fn(i) for every i in [begin, end), in parallel on pool, in chunks
+// of at least grain indices. Returns once every call has finished. A call
+// that throws does not stop the others, even in its own chunk; one of the
+// exceptions is rethrown once every index has been attempted.
+template <typename Function>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, Function fn, size_t grain = 1) {
+  if (begin >= end) {
+    return;
+  }
+
+  size_t n = end - begin;
+  grain = std::max<size_t>(grain, 1);
+  size_t chunks = std::min((n + grain - 1) / grain, pool.size() * 4);
+  size_t chunk_size = (n + chunks - 1) / chunks;
+  chunks = (n + chunk_size - 1) / chunk_size;
+
+  struct state {
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  } shared;
+  shared.remaining = chunks;
+
+  for (size_t c = 0; c < chunks; c++) {
+    size_t first = begin + c * chunk_size,
+      last = std::min(end, first + chunk_size);
+    pool.submit([&shared, &fn, first, last] {
+      for (size_t i = first; i < last; i++) {
+        try {
+          fn(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(shared.mutex);
+          if (!shared.error) {
+            shared.error = std::current_exception();
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      if (--shared.remaining == 0) {
+        shared.done.notify_all();
+      }
+    });
+  }
+
+  // a worker helps out until every chunk is finished, so nested calls
+  // cannot deadlock; any other caller only waits, so the work runs on
+  // exactly the pool's threads
+  bool help = pool.is_worker();
+  while (shared.remaining > 0) {
+    if (!help || !pool.try_run_one()) {
+      std::unique_lock<std::mutex> lock(shared.mutex);
+      shared.done.wait_for(lock, std::chrono::milliseconds(1),
+                           [&shared] { return shared.remaining == 0; });
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(shared.mutex);
+  if (shared.error) {
+    std::rethrow_exception(shared.error);
+  }
+}
+
+// Combines map(i) for every i in [begin, end) with combine, starting from
+// identity, in parallel on pool. Partial results are combined in index
+// order, so combine need only be associative.
+template <typename T, typename Map, typename Combine>
+T parallel_reduce(ThreadPool& pool, size_t begin, size_t end, T identity,
+                  Map map, Combine combine, size_t grain = 1) {
+  if (begin >= end) {
+    return identity;
+  }
+
+  size_t n = end - begin;
+  grain = std::max<size_t>(grain, 1);
+  size_t chunks = std::min((n + grain - 1) / grain, pool.size() * 4);
+  size_t chunk_size = (n + chunks - 1) / chunks;
+  chunks = (n + chunk_size - 1) / chunk_size;
+
+  std::vector<T> partials(chunks, identity);
+  parallel_for(pool, 0, chunks, [&](size_t c) {
+    size_t first = begin + c * chunk_size,
+      last = std::min(end, first + chunk_size);
+    T partial = identity;
+    for (size_t i = first; i < last; i++) {
+      partial = combine(partial, map(i));
+    }
+    partials[c] = partial;
+  });
+
+  T result = identity;
+  for (const T& partial : partials) {
+    result = combine(result, partial);
+  }
+  return result;
+}
@@ -9,13 +9,24 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <random>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
 
 #include "algorithms.hpp"
 #include "timer.hpp"
+#include "trace.hpp"
 
 enum class algo_choice { rle, lfs, date };
 
@@ -24,38 +35,309 @@ const size_t MIN_N{10},
 
 const unsigned LFS_K{20}; // k value for longest frequent substring
 
+const size_t SCALING_BATCH_SIZE{64}; // inputs per batch for --threads
+
+const size_t FILL_BLOCK_SIZE{1 << 16}; // characters per parallel fill task
+
 void print_bar() {
   std::cout << std::string(79, '-') << std::endl;
 }
 
 void print_usage() {
   std::cout << "usage:" << std::endl << std::endl
-	    << "    timing <ALGO> <N>" << std::endl << std::endl
+	    << "    timing <ALGO> <N> [--threads] [--seed <S>] [--huge-pages] [--trace <JSON>]"
+	    << std::endl
+	    << "    timing lfs --file <PATH> [--trace <JSON>]" << std::endl << std::endl
 	    << "where" << std::endl << std::endl
 	    << "    <ALGO> is one of: rle lfs date" << std::endl
 	    << "    <N> is an integer string length (at least " << MIN_N << ")" << std::endl
+	    << "    --threads times a batch of " << SCALING_BATCH_SIZE << " inputs on 1, 2, 4, ..."
+	    << std::endl
+	    << "              threads up to all cores and reports scaling efficiency" << std::endl
+	    << "    --seed <S> seeds the input generator (default: <N>)" << std::endl
+	    << "    --huge-pages asks for transparent huge pages for the input buffer" << std::endl
+	    << "    --file <PATH> runs the out-of-core lfs over the contents of <PATH>"
+	    << std::endl
+	    << "    --trace <JSON> writes the algorithm's phase spans as Chrome trace-event"
+	    << std::endl
+	    << "              JSON (only in builds with tracing, see \"make timing_trace\")"
+	    << std::endl
 	    << std::endl
 	    << "Example:" << std::endl
 	    << "    $ ./timing rle 5000" << std::endl
+	    << "    $ ./timing date 100 --threads" << std::endl
+	    << "    $ ./timing lfs --file corpus.txt" << std::endl
 	    << std::endl;
 }
 
+// splitmix64 output function: a bijective mix of a 64-bit counter.
+uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+// Fill out[0, n) with random lower-case letters, in parallel on pool.
+//
+// The generator is counter based: characters 8j through 8j+7 all come
+// from splitmix64(key ^ j), where key = splitmix64(seed), taking one
+// letter at a time from the high bits of repeated multiplication by 26.
+// So each character depends only on the seed and its index, and the
+// output is the same for any number of threads. The seed is mixed in as a
+// key rather than added to the counter, so nearby seeds do not give
+// shifted copies of the same stream.
+void fill_random_letters(ThreadPool& pool, char* out, size_t n, uint64_t seed) {
+  const uint64_t key = splitmix64(seed);
+  size_t blocks = (n + FILL_BLOCK_SIZE - 1) / FILL_BLOCK_SIZE;
+  parallel_for(pool, 0, blocks, [&](size_t block) {
+    size_t first = block * FILL_BLOCK_SIZE,
+      last = std::min(n, first + FILL_BLOCK_SIZE);
+    for (size_t i = first; i < last; i += 8) {
+      uint64_t x = splitmix64(key ^ (i / 8));
+      for (size_t k = i; k < std::min(last, i + 8); k++) {
+        unsigned __int128 product = static_cast<unsigned __int128>(x) * 26;
+        out[k] = 'a' + static_cast<char>(product >> 64);
+        x = static_cast<uint64_t>(product);
+      }
+    }
+  });
+}
+
+// Ask the kernel to back the pages of buffer[0, size) that are not yet
+// touched with transparent huge pages. Has no effect where that is not
+// supported.
+void advise_huge_pages(char* buffer, size_t size) {
+#ifdef MADV_HUGEPAGE
+  const uintptr_t HUGE_PAGE_SIZE = 2 << 20;
+  uintptr_t first = (reinterpret_cast<uintptr_t>(buffer) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1),
+    last = (reinterpret_cast<uintptr_t>(buffer) + size) & ~(HUGE_PAGE_SIZE - 1);
+  if (first < last) {
+    madvise(reinterpret_cast<void*>(first), last - first, MADV_HUGEPAGE);
+  }
+#endif
+}
+
+// Fill out[0, n) with spaces, in parallel on pool.
+void fill_spaces(ThreadPool& pool, char* out, size_t n) {
+  size_t blocks = (n + FILL_BLOCK_SIZE - 1) / FILL_BLOCK_SIZE;
+  parallel_for(pool, 0, blocks, [&](size_t block) {
+    size_t first = block * FILL_BLOCK_SIZE;
+    std::memset(out + first, ' ', std::min(n, first + FILL_BLOCK_SIZE) - first);
+  });
+}
+
+// Generated input text. The buffer is allocated without being
+// initialized, unlike a std::string resize, so the parallel fill is the
+// first touch of every page.
+class InputBuffer {
+private:
+  std::unique_ptr<char[]> _data;
+  size_t _size;
+
+public:
+  explicit InputBuffer(size_t size) : _data(new char[size]), _size(size) { }
+
+  char* data() {
+    return _data.get();
+  }
+
+  std::string_view view() const {
+    return std::string_view(_data.get(), _size);
+  }
+};
+
+// Build an input of length n for algo, deterministically from seed.
+InputBuffer make_input(algo_choice algo, size_t n, uint64_t seed,
+		       bool huge_pages, ThreadPool& pool) {
+  InputBuffer input(n);
+  if (huge_pages) {
+    // advise before the fill touches the pages
+    advise_huge_pages(input.data(), n);
+  }
+  if (algo != algo_choice::date) {
+    // rle and lfs can use a string of random letters
+    fill_random_letters(pool, input.data(), n, seed);
+  } else {
+    // date needs a properly-formatted date, padded with spaces
+    // build a random "Y-M-D" string
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned> rand_year(1900, 2099),
+      rand_month(1, 12),
+      rand_day(1, 31);
+    std::stringstream ss;
+    ss << rand_year(rng) << "-" << rand_month(rng) << "-" << rand_day(rng);
+    std::string date_str = ss.str();
+    assert(n >= date_str.size()); // the reason for MIN_N
+    size_t padding_chars = n - date_str.size();
+    fill_spaces(pool, input.data(), padding_chars);
+    std::memcpy(input.data() + padding_chars, date_str.data(), date_str.size());
+  }
+  // check that input size is correct
+  assert(input.view().size() == n);
+  return input;
+}
+
+// Time a batch of inputs on thread pools of 1, 2, 4, ... up to all
+// hardware threads, and print the speedup and efficiency of each relative
+// to one thread.
+void report_scaling(algo_choice algo, size_t n, uint64_t seed,
+		    bool huge_pages, ThreadPool& generator_pool) {
+  std::vector<std::string> inputs;
+  std::vector<std::pair<std::string, unsigned>> queries;
+  for (size_t i = 0; i < SCALING_BATCH_SIZE; i++) {
+    // the batch functions take std::string, so each input is copied once
+    inputs.emplace_back(make_input(algo, n, seed + i * n, huge_pages, generator_pool).view());
+    queries.emplace_back(inputs.back(), LFS_K);
+  }
+
+  std::vector<size_t> thread_counts;
+  size_t all_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t t = 1; t < all_threads; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(all_threads);
+
+  std::cout << "batch size = " << SCALING_BATCH_SIZE << std::endl;
+
+  double single_thread_elapsed = 0;
+  for (size_t threads : thread_counts) {
+    ThreadPool pool(threads);
+
+    // note that there is no input/output while the timer is running
+    Timer timer;
+    switch (algo) {
+    case algo_choice::rle:
+      algorithms::run_length_encode_batch(pool, inputs);
+      break;
+    case algo_choice::lfs:
+      algorithms::longest_frequent_substring_batch(pool, queries);
+      break;
+    case algo_choice::date:
+      algorithms::reformat_date_batch(pool, inputs);
+      break;
+    }
+    double elapsed = timer.elapsed();
+
+    if (threads == 1) {
+      single_thread_elapsed = elapsed;
+    }
+    double speedup = single_thread_elapsed / elapsed;
+    std::cout << "threads=" << threads
+	      << " elapsed time=" << elapsed << " seconds"
+	      << " speedup=" << speedup
+	      << " efficiency=" << speedup / threads << std::endl;
+  }
+}
+
+// Write the recorded trace spans to path as Chrome trace-event JSON, if
+// path is not empty.
+void write_trace(const std::string& path) {
+#ifdef ALGORITHMS_TRACE
+  if (!path.empty()) {
+    std::ofstream out(path);
+    trace::write_chrome_json(out);
+    std::cout << "trace written to " << path << std::endl;
+  }
+#endif
+}
+
+// Time the out-of-core longest_frequent_substring over a file. Returns
+// an exit code.
+int time_lfs_file(const std::string& path) {
+  print_bar();
+  std::cout << "algo = lfs" << std::endl
+	    << "file = " << path << std::endl;
+
+  // note that there is no input/output while the timer is running
+  Timer timer;
+  std::string best;
+  try {
+    best = algorithms::longest_frequent_substring_file(path, LFS_K);
+  } catch (const std::system_error& e) {
+    std::cout << "error: " << e.what() << std::endl;
+    return 1;
+  }
+  double elapsed = timer.elapsed();
+
+  std::cout << "result length = " << best.size() << std::endl
+	    << "elapsed time=" << elapsed << " seconds" << std::endl;
+  print_bar();
+  return 0;
+}
+
 int main(int argc, char* argv[]) {
 
   // Exit codes
   const int SUCCESS = 0, USAGE_ERROR = 1;
 
-  // First, try to parse commandline arguments for algo choice and n.
+  // First, try to parse commandline arguments for algo choice, n, and
+  // options.
   algo_choice algo;
   size_t n;
-  
-  if (argc != 3) {
+  bool scaling = false, huge_pages = false, seed_given = false;
+  uint64_t seed = 0;
+  std::string file_path, trace_path;
+
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    if (arg == "--threads") {
+      scaling = true;
+    } else if (arg == "--file" && i + 1 < argc) {
+      file_path = argv[++i];
+    } else if (arg == "--huge-pages") {
+      huge_pages = true;
+    } else if (arg == "--seed" && i + 1 < argc) {
+      try {
+	seed = std::stoull(argv[++i]);
+	seed_given = true;
+      } catch (const std::exception& e) {
+	std::cout << "error: <S> must be an integer"
+		  << std::endl << std::endl;
+	print_usage();
+	return USAGE_ERROR;
+      }
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cout << "error: unknown option \"" << arg << "\""
+		<< std::endl << std::endl;
+      print_usage();
+      return USAGE_ERROR;
+    } else {
+      positional.push_back(arg);
+    }
+  }
+
+#ifndef ALGORITHMS_TRACE
+  if (!trace_path.empty()) {
+    std::cout << "error: --trace needs a build with tracing, see \"make timing_trace\""
+	      << std::endl << std::endl;
+    print_usage();
+    return USAGE_ERROR;
+  }
+#endif
+
+  if (!file_path.empty()) {
+    if (positional.size() != 1 || positional[0] != "lfs" || scaling) {
+      std::cout << "error: --file only applies to lfs"
+		<< std::endl << std::endl;
+      print_usage();
+      return USAGE_ERROR;
+    }
+    int status = time_lfs_file(file_path);
+    write_trace(trace_path);
+    return status;
+  }
+
+  if (positional.size() != 2) {
     print_usage();
     return USAGE_ERROR;
   }
 
-  std::string algo_str{argv[1]},
-    n_str{argv[2]};
+  std::string algo_str{positional[0]},
+    n_str{positional[1]};
 
   if (algo_str == "rle") {
     algo = algo_choice::rle;
@@ -96,31 +378,14 @@ int main(int argc, char* argv[]) {
   // n should be initialized
   assert(n >= MIN_N);
 
-  // build an input string
-  std::string input;
-  std::mt19937 rng(n); // use a deterministic seed for reproducibility between runs
-  if (algo != algo_choice::date) {
-    // rle and lfs can use a string of random letters
-    std::uniform_int_distribution<int> rand_letter('a', 'z');
-    while (input.size() < n) {
-      input.push_back(rand_letter(rng));
-    }
-  } else {
-    // date needs a properly-formatted date, padded with spaces
-    // build a random "Y-M-D" string
-    std::uniform_int_distribution<unsigned> rand_year(1900, 2099),
-      rand_month(1, 12),
-      rand_day(1, 31);
-    std::stringstream ss;
-    ss << rand_year(rng) << "-" << rand_month(rng) << "-" << rand_day(rng);
-    std::string date_str = ss.str();
-    assert(n >= date_str.size()); // the reason for MIN_N
-    size_t padding_chars = n - date_str.size();
-    input.assign(padding_chars, ' ');
-    input += date_str;
+  // build an input string, on every core
+  if (!seed_given) {
+    seed = n; // use a deterministic seed for reproducibility between runs
   }
-  // check that input size is correct
-  assert(input.size() == n);
+  ThreadPool generator_pool;
+  Timer generation_timer;
+  InputBuffer input = make_input(algo, n, seed, huge_pages, generator_pool);
+  double generation_elapsed = generation_timer.elapsed();
 
   // prepare to run algorithm with timer
   Timer timer;    // see timer.hpp
@@ -141,13 +406,28 @@ int main(int argc, char* argv[]) {
   }
   
   std::cout << std::endl
-	    << "n = " << n << std::endl;
+	    << "n = " << n << std::endl
+	    << "input generation time=" << generation_elapsed << " seconds" << std::endl;
+
+  if (scaling) {
+    report_scaling(algo, n, seed, huge_pages, generator_pool);
+    write_trace(trace_path);
+    print_bar();
+    return SUCCESS;
+  }
 
-  size_t input_preview_size = std::min(input.size(), MAX_INPUT_PREVIEW_SIZE);
+  size_t input_preview_size = std::min(input.view().size(), MAX_INPUT_PREVIEW_SIZE);
   std::cout << "first " << input_preview_size << " characters of input:"
 	    << std::endl
-	    << std::string(input.begin(), input.begin() + input_preview_size)
+	    << input.view().substr(0, input_preview_size)
 	    << std::endl;
+
+  // longest_frequent_substring takes a std::string; its inputs are small,
+  // so copy before the timer starts
+  std::string lfs_input;
+  if (algo == algo_choice::lfs) {
+    lfs_input.assign(input.view());
+  }
   
   // run the algorithm
   // note that there is no input/output while the timer is running
@@ -156,13 +436,13 @@ int main(int argc, char* argv[]) {
   
   switch (algo) {
   case algo_choice::rle:
-    algorithms::run_length_encode(input);
+    algorithms::run_length_encode(input.view());
     break;
   case algo_choice::lfs:
-    algorithms::longest_frequent_substring(input, LFS_K);
+    algorithms::longest_frequent_substring(lfs_input, LFS_K);
     break;
   case algo_choice::date:
-    algorithms::reformat_date(input);
+    algorithms::reformat_date(input.view());
     break;
   }
 
@@ -172,6 +452,8 @@ int main(int argc, char* argv[]) {
 
   std::cout << "elapsed time=" << elapsed << " seconds" << std::endl;
 
+  write_trace(trace_path);
+
   print_bar();
 
   return SUCCESS;
@@ -0,0 +1,152 @@
+///////////////////////////////////////////////////////////////////////////////
+// trace.hpp
+//
+// Scoped trace spans for timing the phases inside an algorithm, dumped as
+// Chrome trace-event JSON that chrome://tracing or Perfetto
+// (ui.perfetto.dev) can open from a local file.
+//
+// Spans are compiled in only when ALGORITHMS_TRACE is defined; otherwise
+// TRACE_SPAN expands to nothing and costs nothing. Each thread records
+// into its own fixed-size ring buffer without locking; when a ring fills,
+// the oldest events are overwritten.
+//
+// How to use:
+//
+//    void phase() {
+//      TRACE_SPAN("phase");  // name must be a string literal
+//      ...                   // span ends when the scope does
+//    }
+//
+//    // once the traced work has finished
+//    std::ofstream out("trace.json");
+//    trace::write_chrome_json(out);
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#ifdef ALGORITHMS_TRACE
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace trace {
+
+  struct event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+  };
+
+  // Events kept per thread.
+  const size_t RING_CAPACITY = 1 << 16;
+
+  struct ring {
+    std::array<event, RING_CAPACITY> events;
+    std::atomic<uint64_t> head{0}; // events ever recorded
+    unsigned thread_id;
+  };
+
+  // Every ring ever created. Rings are never freed, so events from
+  // threads that have exited can still be dumped.
+  struct registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ring>> rings;
+  };
+
+  registry& global_registry() {
+    static registry r;
+    return r;
+  }
+
+  // The calling thread's ring, registered on first use.
+  ring& local_ring() {
+    static thread_local ring* local = nullptr;
+    if (local == nullptr) {
+      registry& r = global_registry();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      r.rings.emplace_back(new ring);
+      local = r.rings.back().get();
+      local->thread_id = r.rings.size();
+    }
+    return *local;
+  }
+
+  // Nanoseconds since the first call.
+  uint64_t now_ns() {
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - origin).count();
+  }
+
+  void record(const char* name, uint64_t start_ns, uint64_t duration_ns) {
+    ring& r = local_ring();
+    uint64_t head = r.head.load(std::memory_order_relaxed);
+    r.events[head % RING_CAPACITY] = event{ name, start_ns, duration_ns };
+    r.head.store(head + 1, std::memory_order_release);
+  }
+
+  // Records the time from its construction to its destruction.
+  class Span {
+  private:
+    const char* _name;
+    uint64_t _start;
+
+  public:
+    explicit Span(const char* name) : _name(name), _start(now_ns()) { }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+      record(_name, _start, now_ns() - _start);
+    }
+  };
+
+  // Writes every recorded event as a Chrome trace-event JSON document.
+  // Call it after the traced threads have finished recording.
+  void write_chrome_json(std::ostream& out) {
+    registry& r = global_registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const std::unique_ptr<ring>& thread_ring : r.rings) {
+      uint64_t head = thread_ring->head.load(std::memory_order_acquire);
+      uint64_t oldest = (head > RING_CAPACITY) ? head - RING_CAPACITY : 0;
+      for (uint64_t i = oldest; i < head; i++) {
+        const event& e = thread_ring->events[i % RING_CAPACITY];
+        out << (first ? "" : ",") << "\n{\"name\":\"" << e.name
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_ring->thread_id
+            << ",\"ts\":" << e.start_ns / 1000.0
+            << ",\"dur\":" << e.duration_ns / 1000.0 << "}";
+        first = false;
+      }
+    }
+    out << "\n]}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+  }
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) ::trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name) ((void) 0)
+
+#endif